@@ -0,0 +1,220 @@
+#ifndef MATRIX_ALLOCATOR_H
+#define MATRIX_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/**
+ * Pool of aligned memory buffers, shared by the whole library.
+ *
+ * Requests are rounded up to a size class (four classes for every power of two), and freed buffers are kept in a free
+ * list of their class: the many same-sized blocks created by a multiplication reuse the buffers of the previous ones,
+ * instead of asking the system for new pages every time.
+ * At most <code>cacheLimit()</code> bytes are kept in the free lists; buffers over the limit are returned to the system.
+ *
+ * Buffers of at least HUGE_PAGE_SIZE bytes can be backed by transparent huge pages: this is disabled by default, and can
+ * be enabled with the environment variable <code>MATRIX_HUGE_PAGES=1</code> or with <code>setHugePages()</code>.
+ */
+class BufferPool {
+	public:
+		//Every buffer starts on a cache line, so it's aligned for any vector instruction
+		static const std::size_t ALIGNMENT = 64;
+		static const std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	private:
+		std::mutex mutex;
+		std::map<std::size_t, std::vector<void *>> freeLists;
+		std::size_t cachedBytes = 0;
+		std::size_t maxCachedBytes = 256 * 1024 * 1024;
+		bool hugePages;
+
+		BufferPool() {
+			const char *env = std::getenv("MATRIX_HUGE_PAGES");
+			this->hugePages = env != NULL && std::atoi(env) > 0;
+		}
+
+	public:
+		BufferPool(const BufferPool &) = delete;
+
+		/**
+		 * @return the pool used by the library
+		 */
+		static BufferPool &instance() {
+			//Never destroyed, so that matrices with static storage can be freed after it
+			static BufferPool *pool = new BufferPool();
+			return *pool;
+		}
+
+		/**
+		 * @return a buffer of at least the given number of bytes, aligned to ALIGNMENT
+		 */
+		void *allocate(std::size_t bytes) {
+			std::size_t size = sizeClass(bytes);
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				auto list = this->freeLists.find(size);
+				if (list != this->freeLists.end() && !list->second.empty()) {
+					void *buffer = list->second.back();
+					list->second.pop_back();
+					this->cachedBytes -= size;
+					return buffer;
+				}
+			}
+			return this->allocateFromSystem(size);
+		}
+
+		/**
+		 * Gives back a buffer returned by allocate(bytes)
+		 */
+		void deallocate(void *buffer, std::size_t bytes) {
+			std::size_t size = sizeClass(bytes);
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				if (this->cachedBytes + size <= this->maxCachedBytes) {
+					this->freeLists[size].push_back(buffer);
+					this->cachedBytes += size;
+					return;
+				}
+			}
+			freeToSystem(buffer);
+		}
+
+		/**
+		 * Returns all the cached buffers to the system
+		 */
+		void trim() {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			for (auto &list : this->freeLists) {
+				for (void *buffer : list.second) {
+					freeToSystem(buffer);
+				}
+			}
+			this->freeLists.clear();
+			this->cachedBytes = 0;
+		}
+
+		std::size_t cacheLimit() const {
+			return this->maxCachedBytes;
+		}
+
+		/**
+		 * Sets the maximum number of bytes kept in the free lists
+		 */
+		void setCacheLimit(std::size_t bytes) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->maxCachedBytes = bytes;
+		}
+
+		/**
+		 * Enables or disables transparent huge pages for the buffers allocated from now on
+		 */
+		void setHugePages(bool enabled) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->hugePages = enabled;
+		}
+
+		/**
+		 * @return the size of the buffer actually used for a request of the given number of bytes
+		 */
+		static std::size_t sizeClass(std::size_t bytes) {
+			if (bytes <= ALIGNMENT * 4) {
+				return ALIGNMENT * 4;
+			}
+			//E.g. requests between 4097 and 5120 bytes use buffers of 5120 bytes
+			std::size_t power = 1;
+			while (power * 2 <= bytes) {
+				power *= 2;
+			}
+			std::size_t step = power / 4;
+			return (bytes + step - 1) / step * step;
+		}
+
+	private:
+		void *allocateFromSystem(std::size_t size) {
+			bool huge = this->hugePages && size >= HUGE_PAGE_SIZE;
+			void *buffer = NULL;
+#if defined(_WIN32)
+			buffer = _aligned_malloc(size, ALIGNMENT);
+#else
+			if (posix_memalign(&buffer, huge ? HUGE_PAGE_SIZE : ALIGNMENT, size) != 0) {
+				buffer = NULL;
+			}
+#endif
+			if (buffer == NULL) {
+				throw std::bad_alloc();
+			}
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+			if (huge) {
+				//Only a hint: if the kernel doesn't support it, normal pages are used
+				madvise(buffer, size, MADV_HUGEPAGE);
+			}
+#endif
+			return buffer;
+		}
+
+		static void freeToSystem(void *buffer) {
+#if defined(_WIN32)
+			_aligned_free(buffer);
+#else
+			std::free(buffer);
+#endif
+		}
+};
+
+/**
+ * Allocator that takes its memory from the <code>BufferPool</code>.
+ *
+ * Elements constructed without arguments are default-initialized: a <code>std::vector<T, PoolAllocator<T>>(n)</code> of a
+ * primitive type is not zeroed, so buffers that are going to be overwritten don't pay for it. Use the constructor
+ * <code>(n, T())</code> to get a zeroed vector.
+ * @tparam T type of the data
+ */
+template<typename T>
+class PoolAllocator {
+	public:
+		typedef T value_type;
+
+		template<typename U>
+		struct rebind {
+			typedef PoolAllocator<U> other;
+		};
+
+		PoolAllocator() = default;
+
+		template<typename U>
+		PoolAllocator(const PoolAllocator<U> &) {}
+
+		T *allocate(std::size_t n) {
+			return static_cast<T *>(BufferPool::instance().allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T *p, std::size_t n) {
+			BufferPool::instance().deallocate(p, n * sizeof(T));
+		}
+
+		template<typename U>
+		void construct(U *p) {
+			::new((void *) p) U;
+		}
+
+		template<typename U, typename... Args>
+		void construct(U *p, Args &&... args) {
+			::new((void *) p) U(std::forward<Args>(args)...);
+		}
+
+		template<typename U>
+		bool operator==(const PoolAllocator<U> &) const { return true; }
+
+		template<typename U>
+		bool operator!=(const PoolAllocator<U> &) const { return false; }
+};
+
+#endif //MATRIX_ALLOCATOR_H
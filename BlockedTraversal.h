@@ -0,0 +1,43 @@
+#ifndef MATRIX_BLOCKEDTRAVERSAL_H
+#define MATRIX_BLOCKEDTRAVERSAL_H
+
+/**
+ * Cache-oblivious traversal of a rectangular region.
+ *
+ * The region is recursively split in two along its largest dimension, until the blocks are small enough to be in
+ * the L1 cache. This way both a row-wise and a column-wise access of the source (e.g. when reading a transposed matrix)
+ * touch only a few cache lines and pages at a time, without having to know the size of the caches.
+ */
+class BlockedTraversal {
+	public:
+		//Blocks of at most 32x32 cells are visited with two nested loops
+		static const unsigned LEAF_SIZE = 32;
+
+		/**
+		 * Calls visit(row, col) for each cell of the region
+		 */
+		template<class F>
+		static void traverse(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns, F &visit) {
+			while (rows > LEAF_SIZE || columns > LEAF_SIZE) {
+				//Visiting the first half, and continuing with the second one
+				if (rows >= columns) {
+					unsigned half = rows / 2;
+					traverse(rowOffset, colOffset, half, columns, visit);
+					rowOffset += half;
+					rows -= half;
+				} else {
+					unsigned half = columns / 2;
+					traverse(rowOffset, colOffset, rows, half, visit);
+					colOffset += half;
+					columns -= half;
+				}
+			}
+			for (unsigned r = rowOffset; r < rowOffset + rows; r++) {
+				for (unsigned c = colOffset; c < colOffset + columns; c++) {
+					visit(r, c);
+				}
+			}
+		}
+};
+
+#endif //MATRIX_BLOCKEDTRAVERSAL_H
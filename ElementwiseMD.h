@@ -0,0 +1,259 @@
+#ifndef MATRIX_ELEMENTWISEMD_H
+#define MATRIX_ELEMENTWISEMD_H
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include "MatrixData.h"
+
+//This macro is the version of MATERIALIZE_IMPL for the elementwise expressions: instead of reading the cells one at a
+//time, the whole expression is evaluated a chunk of a row at a time by Elementwise::materializeInto()
+#define ELEMENTWISE_MATERIALIZE_IMPL        \
+void virtualMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns, const StridedData<T> &destination) const override {\
+    if (rowOffset + rows > this->rows() || colOffset + columns > this->columns()) {\
+        Utils::error("Illegal bounds");\
+    }\
+    if (!this->optimizeHasBeenCalled.load(std::memory_order_acquire)) {\
+        this->optimize();\
+    }\
+    Profiler::Scope scope(this, Profiler::current(), true);\
+    Profiler::addBytes((long long) rows * columns * sizeof(T));\
+    Elementwise<T>::materializeInto(*this, rowOffset, colOffset, rows, columns, destination);\
+}\
+\
+VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const override {\
+    VectorMatrixData<T> ret = VectorMatrixData<T>::uninitialized(rows, columns);\
+    this->virtualMaterializeInto(rowOffset, colOffset, rows, columns, ret.strided());\
+    return ret;\
+}\
+\
+StridedData<T> virtualGetStrided() const override {\
+    return this->strided();\
+}\
+\
+T get(unsigned row, unsigned col) const {\
+    if (!this->optimizeHasBeenCalled.load(std::memory_order_acquire)) {\
+        this->optimize();\
+    }\
+    return this->doGet(row, col);\
+}
+
+/**
+ * Base of the implementations of <code>MatrixData</code> whose cell (r, c) is computed only from the cells (r, c) of
+ * their operands. They expose loadChunk(row, col, length, buffer), that computes a run of cells of a row with a loop over
+ * arrays, which the compiler vectorizes.
+ */
+struct ElementwiseTag {
+};
+
+/**
+ * Fused evaluation of the elementwise expressions.
+ *
+ * A whole expression (e.g. <code>2 * a + b.hadamard(c)</code>) is evaluated a chunk of a row at a time: every node
+ * computes the chunk from the chunks of its operands, which stay in L1 in small buffers on the stack. Operands that are
+ * not elementwise are read from their memory when it's strided, or materialized a chunk at a time otherwise.
+ * @tparam T type of the data
+ */
+template<typename T>
+struct Elementwise {
+	//Number of cells of a row computed at a time
+	static constexpr unsigned CHUNK = 128;
+
+	/**
+	 * Computes the cells of the given row, from col to col + length - 1 (at most CHUNK)
+	 * @return a pointer to the cells: they are either in the memory of the matrix or in the given buffer
+	 */
+	template<class MD>
+	static const T *load(const MD &matrix, unsigned row, unsigned col, unsigned length, T *buffer) {
+		return load(matrix, row, col, length, buffer, std::is_base_of<ElementwiseTag, MD>());
+	}
+
+	/**
+	 * Computes function(left, right) on a chunk, writing it to the buffer
+	 */
+	template<class MD1, class MD2, class F>
+	static const T *zip(const MD1 &left, const MD2 &right, const F &function, unsigned row, unsigned col, unsigned length,
+						T *buffer) {
+		alignas(64) T rightBuffer[CHUNK];
+		const T *l = load(left, row, col, length, buffer);
+		const T *r = load(right, row, col, length, rightBuffer);
+		for (unsigned i = 0; i < length; i++) {
+			buffer[i] = function(l[i], r[i]);
+		}
+		return buffer;
+	}
+
+	/**
+	 * Evaluates the given region of an elementwise matrix into the destination. The cells of a chunk are written only
+	 * after all the operands have been read, so the destination can be the memory of an operand (see virtualAliases()).
+	 */
+	template<class MD>
+	static void materializeInto(const MD &matrix, unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+								const StridedData<T> &destination) {
+		alignas(64) T buffer[CHUNK];
+		//Going down the rows a chunk of columns at a time, so that a transposed operand touches only CHUNK cache lines
+		for (unsigned c = 0; c < columns; c += CHUNK) {
+			unsigned length = std::min(CHUNK, columns - c);
+			for (unsigned r = 0; r < rows; r++) {
+				const T *values = matrix.loadChunk(rowOffset + r, colOffset + c, length, buffer);
+				T *output = destination.at(r, c);
+				if (destination.hasContiguousRows()) {
+					std::memmove(output, values, length * sizeof(T));
+				} else {
+					for (unsigned i = 0; i < length; i++) {
+						output[i * destination.colStride] = values[i];
+					}
+				}
+			}
+		}
+	}
+
+	private:
+		template<class MD>
+		static const T *load(const MD &matrix, unsigned row, unsigned col, unsigned length, T *buffer, std::true_type) {
+			return matrix.loadChunk(row, col, length, buffer);
+		}
+
+		template<class MD>
+		static const T *load(const MD &matrix, unsigned row, unsigned col, unsigned length, T *buffer, std::false_type) {
+			StridedData<T> memory = matrix.strided();
+			if (!memory.isValid()) {
+				matrix.virtualMaterializeInto(row, col, 1, length, StridedData<T>(buffer, length, 1));
+				return buffer;
+			}
+			const T *input = memory.at(row, col);
+			if (memory.hasContiguousRows()) {
+				return input;
+			}
+			for (unsigned i = 0; i < length; i++) {
+				buffer[i] = input[i * memory.colStride];
+			}
+			return buffer;
+		}
+};
+
+template<typename T>
+constexpr unsigned Elementwise<T>::CHUNK;
+
+/**
+ * Multiplication by a scalar, to be used with <code>MapMD</code>
+ */
+template<typename T>
+struct Scale {
+	T factor;
+
+	T operator()(const T &value) const {
+		return this->factor * value;
+	}
+};
+
+/**
+ * Appends the fingerprint of a function of an elementwise expression. A function without state (e.g. std::minus, or a
+ * lambda without captures) is identified by its type, which is already in the fingerprint of the expression.
+ * @return false if the function has a state that cannot be identified
+ */
+template<class F>
+bool appendFunctionFingerprint(const F &/*function*/, Fingerprint &/*fingerprint*/) {
+	return std::is_empty<F>::value;
+}
+
+template<typename T>
+bool appendFunctionFingerprint(const Scale<T> &scale, Fingerprint &fingerprint) {
+	if (!std::is_arithmetic<T>::value) {
+		return false;
+	}
+	//The bits of the factor
+	std::uintptr_t words[(sizeof(T) + sizeof(std::uintptr_t) - 1) / sizeof(std::uintptr_t)] = {};
+	std::memcpy(words, &scale.factor, sizeof(T));
+	fingerprint.insert(fingerprint.end(), std::begin(words), std::end(words));
+	return true;
+}
+
+/**
+ * Implementation of <code>MatrixData</code> that exposes function(cell) for each cell of another matrix (e.g. the
+ * product by a scalar, with <code>Scale</code>)
+ * @tparam T type of the data
+ * @tparam F type of the function, T(T)
+ */
+template<typename T, class MD, class F>
+class MapMD : public SingleMatrixWrapper<T, MD>, public ElementwiseTag {
+	private:
+		F function;
+
+	public:
+		MapMD(MD wrapped, F function) : SingleMatrixWrapper<T, MD>(wrapped, wrapped.rows(), wrapped.columns()), function(function) {
+		}
+
+		ELEMENTWISE_MATERIALIZE_IMPL
+
+		const T *loadChunk(unsigned row, unsigned col, unsigned length, T *buffer) const {
+			const T *input = Elementwise<T>::load(this->wrapped, row, col, length, buffer);
+			for (unsigned i = 0; i < length; i++) {
+				buffer[i] = this->function(input[i]);
+			}
+			return buffer;
+		}
+
+		bool virtualAliases(const MemoryRegion &region, bool sameCells) const override {
+			return this->wrapped.virtualAliases(region, sameCells);
+		}
+
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint) && appendFunctionFingerprint(this->function, fingerprint);
+		}
+
+		MapMD<T, MD, F> copy() const {
+			return MapMD<T, MD, F>(this->wrapped.copy(), this->function);
+		}
+
+	private:
+		T doGet(unsigned row, unsigned col) const {
+			return this->function(this->wrapped.get(row, col));
+		}
+};
+
+/**
+ * Implementation of <code>MatrixData</code> that exposes function(left cell, right cell) for each cell of two matrices
+ * of the same size (e.g. their difference, or their Hadamard product)
+ * @tparam T type of the data
+ * @tparam F type of the function, T(T, T)
+ */
+template<typename T, class MD1, class MD2, class F>
+class ZipMD : public BiMatrixWrapper<T, MD1, MD2>, public ElementwiseTag {
+	private:
+		F function;
+
+	public:
+		ZipMD(MD1 left, MD2 right, F function) : BiMatrixWrapper<T, MD1, MD2>(left, right, left.rows(), left.columns()), function(function) {
+			if (left.rows() != right.rows() || left.columns() != right.columns()) {
+				Utils::error("Elementwise operation between incompatible sizes");
+			}
+		}
+
+		ELEMENTWISE_MATERIALIZE_IMPL
+
+		const T *loadChunk(unsigned row, unsigned col, unsigned length, T *buffer) const {
+			return Elementwise<T>::zip(this->left, this->right, this->function, row, col, length, buffer);
+		}
+
+		bool virtualAliases(const MemoryRegion &region, bool sameCells) const override {
+			return this->left.virtualAliases(region, sameCells) || this->right.virtualAliases(region, sameCells);
+		}
+
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint) && appendFunctionFingerprint(this->function, fingerprint);
+		}
+
+		ZipMD<T, MD1, MD2, F> copy() const {
+			return ZipMD<T, MD1, MD2, F>(this->left.copy(), this->right.copy(), this->function);
+		}
+
+	private:
+		T doGet(unsigned row, unsigned col) const {
+			return this->function(this->left.get(row, col), this->right.get(row, col));
+		}
+};
+
+#endif //MATRIX_ELEMENTWISEMD_H
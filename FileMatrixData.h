@@ -0,0 +1,428 @@
+#ifndef MATRIX_FILEMATRIXDATA_H
+#define MATRIX_FILEMATRIXDATA_H
+
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MatrixData.h"
+#include "MultiplyMD.h"
+
+/**
+ * A matrix stored in a file, divided in tiles of tileRows x tileColumns cells.
+ *
+ * Tiles are stored one after the other in row-major order, each of them row-major and of full size (the tiles on the
+ * border are padded). They are read with <code>pread</code> into a cache of at most maxResidentTiles tiles; when the
+ * cache is full, the least recently used tile is evicted, and written back with <code>pwrite</code> if it was modified.
+ *
+ * Every access holds a mutex, so the file can be used by many threads; the cells are read and written a whole region at
+ * a time, to keep the locking overhead low.
+ * @tparam T type of the data
+ */
+template<typename T>
+class TiledFile {
+	private:
+		struct Tile {
+			std::size_t index;
+			typename VectorMatrixData<T>::Storage cells;
+			bool dirty;
+		};
+
+		int descriptor;
+		bool temporary;
+		unsigned rows, columns, tileRows, tileColumns, tilesPerRow;
+		std::size_t cacheBytes, maxResidentTiles;
+		std::mutex mutex;
+		//The most recently used tiles are at the front
+		std::list<Tile> tiles;
+		std::unordered_map<std::size_t, typename std::list<Tile>::iterator> residentTiles;
+
+	public:
+		TiledFile(int descriptor, bool temporary, unsigned rows, unsigned columns, unsigned tileRows, unsigned tileColumns,
+				  std::size_t cacheBytes) :
+				descriptor(descriptor), temporary(temporary), rows(rows), columns(columns), tileRows(tileRows),
+				tileColumns(tileColumns), tilesPerRow(Utils::ceilDiv(columns, tileColumns)), cacheBytes(cacheBytes) {
+			this->maxResidentTiles = std::max<std::size_t>(1, cacheBytes / this->tileBytes());
+		}
+
+		TiledFile(const TiledFile<T> &) = delete;
+
+		~TiledFile() {
+			if (!this->temporary) {
+				this->flush();
+			}
+			close(this->descriptor);
+		}
+
+		/**
+		 * Opens the file at the given path, creating it if needed, and sets its size for a matrix of the given size.
+		 * @param truncate true to discard the current content of the file
+		 */
+		static std::shared_ptr<TiledFile<T>> open(const std::string &path, bool truncate, unsigned rows, unsigned columns,
+												  unsigned tileRows, unsigned tileColumns, std::size_t cacheBytes) {
+			int descriptor = ::open(path.c_str(), O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+			if (descriptor < 0) {
+				Utils::error("Cannot open the matrix file");
+			}
+			return fromDescriptor(descriptor, false, rows, columns, tileRows, tileColumns, cacheBytes);
+		}
+
+		/**
+		 * Creates an anonymous file in the temporary directory, deleted when it's not used anymore
+		 */
+		static std::shared_ptr<TiledFile<T>> createTemporary(unsigned rows, unsigned columns, unsigned tileRows,
+															 unsigned tileColumns, std::size_t cacheBytes) {
+			const char *directory = std::getenv("TMPDIR");
+			std::string path = std::string(directory != NULL ? directory : "/tmp") + "/matrixXXXXXX";
+			std::vector<char> name(path.begin(), path.end());
+			name.push_back('\0');
+			int descriptor = mkstemp(name.data());
+			if (descriptor < 0) {
+				Utils::error("Cannot create a temporary matrix file");
+			}
+			unlink(name.data());
+			return fromDescriptor(descriptor, true, rows, columns, tileRows, tileColumns, cacheBytes);
+		}
+
+		unsigned getTileRows() const {
+			return this->tileRows;
+		}
+
+		unsigned getTileColumns() const {
+			return this->tileColumns;
+		}
+
+		/**
+		 * @return the maximum size of the tiles kept in memory
+		 */
+		std::size_t getCacheBytes() const {
+			return this->cacheBytes;
+		}
+
+		T get(unsigned row, unsigned col) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			Tile &tile = this->load(row, col);
+			return tile.cells[(row % this->tileRows) * this->tileColumns + col % this->tileColumns];
+		}
+
+		void set(unsigned row, unsigned col, T t) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			Tile &tile = this->load(row, col);
+			tile.cells[(row % this->tileRows) * this->tileColumns + col % this->tileColumns] = t;
+			tile.dirty = true;
+		}
+
+		/**
+		 * Copies the given region to the destination, one tile at a time
+		 */
+		void read(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns, const StridedData<T> &destination) {
+			this->forEachTile(rowOffset, colOffset, rows, columns, [&](Tile &tile, unsigned r, unsigned c, unsigned h, unsigned w) {
+				this->tileMemory(tile, r, c).copyTo(h, w, destination.offset(r - rowOffset, c - colOffset));
+			});
+		}
+
+		/**
+		 * Copies the source to the given region, one tile at a time
+		 */
+		void write(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns, const StridedData<T> &source) {
+			this->forEachTile(rowOffset, colOffset, rows, columns, [&](Tile &tile, unsigned r, unsigned c, unsigned h, unsigned w) {
+				source.offset(r - rowOffset, c - colOffset).copyTo(h, w, this->tileMemory(tile, r, c));
+				tile.dirty = true;
+			});
+		}
+
+		/**
+		 * Writes the modified tiles to the file
+		 */
+		void flush() {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			for (auto &tile : this->tiles) {
+				this->writeBack(tile);
+			}
+		}
+
+	private:
+		static std::shared_ptr<TiledFile<T>> fromDescriptor(int descriptor, bool temporary, unsigned rows, unsigned columns,
+															unsigned tileRows, unsigned tileColumns, std::size_t cacheBytes) {
+			if (tileRows == 0 || tileColumns == 0) {
+				close(descriptor);
+				Utils::error("Tiles cannot be empty");
+			}
+			auto file = std::make_shared<TiledFile<T>>(descriptor, temporary, rows, columns, tileRows, tileColumns, cacheBytes);
+			//Growing the file: the new tiles are read as zeros
+			off_t size = (off_t) Utils::ceilDiv(rows, tileRows) * file->tilesPerRow * file->tileBytes();
+			struct stat info;
+			if (fstat(descriptor, &info) != 0 || (info.st_size < size && ftruncate(descriptor, size) != 0)) {
+				Utils::error("Cannot resize the matrix file");
+			}
+			return file;
+		}
+
+		std::size_t tileBytes() const {
+			return (std::size_t) this->tileRows * this->tileColumns * sizeof(T);
+		}
+
+		/**
+		 * @return the memory of the given tile, starting from the cell (row, col) of the matrix
+		 */
+		StridedData<T> tileMemory(Tile &tile, unsigned row, unsigned col) const {
+			return StridedData<T>(tile.cells.data(), this->tileColumns, 1).offset(row % this->tileRows, col % this->tileColumns);
+		}
+
+		/**
+		 * Calls visit(tile, row, col, rows, columns) for the intersection of the region with each tile, holding the mutex
+		 */
+		template<class F>
+		void forEachTile(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns, F visit) {
+			for (unsigned r = rowOffset; r < rowOffset + rows; r = (r / this->tileRows + 1) * this->tileRows) {
+				unsigned h = std::min((r / this->tileRows + 1) * this->tileRows, rowOffset + rows) - r;
+				for (unsigned c = colOffset; c < colOffset + columns; c = (c / this->tileColumns + 1) * this->tileColumns) {
+					unsigned w = std::min((c / this->tileColumns + 1) * this->tileColumns, colOffset + columns) - c;
+					std::unique_lock<std::mutex> lock(this->mutex);
+					visit(this->load(r, c), r, c, h, w);
+				}
+			}
+		}
+
+		/**
+		 * @return the tile that contains the given cell, reading it if it's not in the cache. The mutex must be held.
+		 */
+		Tile &load(unsigned row, unsigned col) {
+			if (row >= this->rows || col >= this->columns) {
+				Utils::error("Illegal bounds");
+			}
+			std::size_t index = (std::size_t) (row / this->tileRows) * this->tilesPerRow + col / this->tileColumns;
+			auto resident = this->residentTiles.find(index);
+			if (resident != this->residentTiles.end()) {
+				this->tiles.splice(this->tiles.begin(), this->tiles, resident->second);
+				return this->tiles.front();
+			}
+			if (this->tiles.size() >= this->maxResidentTiles) {
+				//Evicting the least recently used tile, reusing its memory
+				this->writeBack(this->tiles.back());
+				this->residentTiles.erase(this->tiles.back().index);
+				this->tiles.splice(this->tiles.begin(), this->tiles, std::prev(this->tiles.end()));
+			} else {
+				this->tiles.push_front(Tile());
+				this->tiles.front().cells.resize((std::size_t) this->tileRows * this->tileColumns);
+			}
+			Tile &tile = this->tiles.front();
+			tile.index = index;
+			tile.dirty = false;
+			this->transfer(tile, false);
+			this->residentTiles[index] = this->tiles.begin();
+			return tile;
+		}
+
+		void writeBack(Tile &tile) {
+			if (tile.dirty) {
+				this->transfer(tile, true);
+				tile.dirty = false;
+			}
+		}
+
+		void transfer(Tile &tile, bool write) {
+			auto *buffer = reinterpret_cast<char *>(tile.cells.data());
+			std::size_t done = 0, total = this->tileBytes();
+			off_t position = (off_t) tile.index * total;
+			while (done < total) {
+				ssize_t count = write ? pwrite(this->descriptor, buffer + done, total - done, position + done)
+									  : pread(this->descriptor, buffer + done, total - done, position + done);
+				if (count <= 0) {
+					Utils::error(write ? "Cannot write the matrix file" : "Cannot read the matrix file");
+				}
+				done += count;
+			}
+		}
+};
+
+/**
+ * Implementation of <code>MatrixData</code> that keeps the matrix in a file, divided in tiles (see <code>TiledFile</code>).
+ * Only a bounded number of tiles is kept in memory, so the matrix can be larger than the RAM.
+ *
+ * Like <code>VectorMatrixData</code>, copies of this object share the same file, while copy() creates a new (temporary) file.
+ * Regions are materialized one tile at a time, so a product streams the tiles of its operands while packing them. Use
+ * <code>assignProduct()</code> to compute a product that doesn't fit in memory directly into the file.
+ * @tparam T type of the data
+ */
+template<typename T>
+class FileMatrixData : public MatrixData<T> {
+	private:
+		std::shared_ptr<TiledFile<T>> file;
+
+		FileMatrixData(unsigned rows, unsigned columns, std::shared_ptr<TiledFile<T>> file) : MatrixData<T>(rows, columns), file(file) {
+		}
+
+	public:
+		static const unsigned DEFAULT_TILE_SIZE = 512;
+		static const std::size_t DEFAULT_CACHE_BYTES = 64 * 1024 * 1024;
+
+		/**
+		 * Creates a matrix of zeros in the given file, overwriting it
+		 * @param cacheBytes the maximum size of the tiles kept in memory
+		 */
+		static FileMatrixData<T> create(const std::string &path, unsigned rows, unsigned columns, unsigned tileSize = DEFAULT_TILE_SIZE,
+										std::size_t cacheBytes = DEFAULT_CACHE_BYTES) {
+			return FileMatrixData<T>(rows, columns, TiledFile<T>::open(path, true, rows, columns, tileSize, tileSize, cacheBytes));
+		}
+
+		/**
+		 * Opens a matrix previously saved in the given file, with the same size and tile size
+		 */
+		static FileMatrixData<T> open(const std::string &path, unsigned rows, unsigned columns, unsigned tileSize = DEFAULT_TILE_SIZE,
+									  std::size_t cacheBytes = DEFAULT_CACHE_BYTES) {
+			return FileMatrixData<T>(rows, columns, TiledFile<T>::open(path, false, rows, columns, tileSize, tileSize, cacheBytes));
+		}
+
+		/**
+		 * Creates a matrix of zeros in a temporary file, deleted when the matrix is not used anymore
+		 */
+		static FileMatrixData<T> temporary(unsigned rows, unsigned columns, unsigned tileSize = DEFAULT_TILE_SIZE,
+										   std::size_t cacheBytes = DEFAULT_CACHE_BYTES) {
+			return FileMatrixData<T>(rows, columns, TiledFile<T>::createTemporary(rows, columns, tileSize, tileSize, cacheBytes));
+		}
+
+		T get(unsigned row, unsigned col) const {
+			return this->file->get(row, col);
+		}
+
+		void set(unsigned row, unsigned col, T t) {
+			this->file->set(row, col, t);
+		}
+
+		StridedData<T> strided() const {
+			return StridedData<T>();
+		}
+
+		StridedData<T> virtualGetStrided() const override {
+			return this->strided();
+		}
+
+		void virtualMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+									const StridedData<T> &destination) const override {
+			if (rowOffset + rows > this->rows() || colOffset + columns > this->columns()) {
+				Utils::error("Illegal bounds");
+			}
+			this->file->read(rowOffset, colOffset, rows, columns, destination);
+		}
+
+		VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const override {
+			VectorMatrixData<T> ret = VectorMatrixData<T>::uninitialized(rows, columns);
+			this->virtualMaterializeInto(rowOffset, colOffset, rows, columns, ret.strided());
+			return ret;
+		}
+
+		FileMatrixData<T> copy() const {
+			FileMatrixData<T> ret(this->rows(), this->columns(), TiledFile<T>::createTemporary(
+					this->rows(), this->columns(), this->file->getTileRows(), this->file->getTileColumns(), this->file->getCacheBytes()));
+			ret.assign(*this);
+			return ret;
+		}
+
+		/**
+		 * Writes the modified tiles to the file
+		 */
+		void flush() {
+			this->file->flush();
+		}
+
+		/**
+		 * Overwrites this matrix with the given one, evaluating it one tile at a time.
+		 * The given matrix must not read this file.
+		 */
+		void assign(const MatrixData<T> &source) {
+			if (source.rows() != this->rows() || source.columns() != this->columns()) {
+				Utils::error("The matrices have different sizes");
+			}
+			this->forEachTile([&](unsigned row, unsigned col, unsigned rows, unsigned columns, VectorMatrixData<T> &buffer) {
+				source.virtualMaterializeInto(row, col, rows, columns, buffer.strided());
+			});
+		}
+
+		/**
+		 * Overwrites this matrix with the product of the given ones, computing it one tile at a time.
+		 * Every tile of the result is accumulated over tile-sized blocks of the operands, so the memory used is bounded by
+		 * the size of the tiles, whatever the size of the matrices. The operands must not read this file.
+		 */
+		void assignProduct(const MatrixData<T> &left, const MatrixData<T> &right) {
+			if (left.columns() != right.rows() || left.rows() != this->rows() || right.columns() != this->columns()) {
+				Utils::error("Multiplication should be performed on compatible matrices");
+			}
+			unsigned depthStep = std::max(this->file->getTileRows(), this->file->getTileColumns());
+			this->forEachTile([&](unsigned row, unsigned col, unsigned rows, unsigned columns, VectorMatrixData<T> &buffer) {
+				StridedData<T> sum = buffer.strided();
+				for (unsigned r = 0; r < rows; r++) {
+					std::fill(sum.at(r, 0), sum.at(r, 0) + columns, T());
+				}
+				for (unsigned k = 0; k < left.columns(); k += depthStep) {
+					unsigned depth = std::min(depthStep, left.columns() - k);
+					RegionMD leftBlock(&left, row, k, rows, depth);
+					RegionMD rightBlock(&right, k, col, depth, columns);
+					OptimizedMultiplyMD<T> product(&leftBlock, &rightBlock);
+					StridedData<T> partial = product.virtualMaterialize(0, 0, rows, columns).strided();
+					for (unsigned r = 0; r < rows; r++) {
+						for (unsigned c = 0; c < columns; c++) {
+							*sum.at(r, c) += *partial.at(r, c);
+						}
+					}
+				}
+			});
+		}
+
+	private:
+		/**
+		 * Calls fill(row, col, rows, columns, buffer) for each tile, and writes the buffer to the tile
+		 */
+		template<class F>
+		void forEachTile(F fill) {
+			unsigned tileRows = this->file->getTileRows(), tileColumns = this->file->getTileColumns();
+			for (unsigned row = 0; row < this->rows(); row += tileRows) {
+				for (unsigned col = 0; col < this->columns(); col += tileColumns) {
+					unsigned rows = std::min(tileRows, this->rows() - row);
+					unsigned columns = std::min(tileColumns, this->columns() - col);
+					auto buffer = VectorMatrixData<T>::uninitialized(rows, columns);
+					fill(row, col, rows, columns, buffer);
+					this->file->write(row, col, rows, columns, buffer.strided());
+				}
+			}
+		}
+
+		/**
+		 * A region of another matrix, that forwards the materialization to it.
+		 * Used to multiply blocks of matrices that don't have a strided layout (e.g. other files) without reading them cell by cell.
+		 */
+		class RegionMD : public MatrixData<T> {
+			private:
+				const MatrixData<T> *wrapped;
+				unsigned rowOffset, colOffset;
+
+			public:
+				RegionMD(const MatrixData<T> *wrapped, unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) :
+						MatrixData<T>(rows, columns), wrapped(wrapped), rowOffset(rowOffset), colOffset(colOffset) {
+				}
+
+				std::vector<const MatrixData<T> *> virtualGetChildren() const override {
+					return {this->wrapped};
+				}
+
+				StridedData<T> virtualGetStrided() const override {
+					return this->wrapped->virtualGetStrided().offset(this->rowOffset, this->colOffset);
+				}
+
+				void virtualMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+											const StridedData<T> &destination) const override {
+					this->wrapped->virtualMaterializeInto(this->rowOffset + rowOffset, this->colOffset + colOffset, rows, columns, destination);
+				}
+
+				VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const override {
+					return this->wrapped->virtualMaterialize(this->rowOffset + rowOffset, this->colOffset + colOffset, rows, columns);
+				}
+		};
+};
+
+#endif //MATRIX_FILEMATRIXDATA_H
@@ -0,0 +1,133 @@
+#ifndef MATRIX_GEMMKERNEL_H
+#define MATRIX_GEMMKERNEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "Allocator.h"
+
+/**
+ * Register-blocked multiplication kernel.
+ *
+ * The left operand is packed in panels of MR rows, stored column by column, and the right operand in panels of NR columns,
+ * stored row by row. The micro-kernel then computes a MRxNR tile of the result keeping it entirely in registers:
+ * for every step of the inner dimension it reads MR values of the left panel and two vectors of the right panel.
+ *
+ * Panels are zero padded to a multiple of MR/NR, so the micro-kernel never needs to check the bounds.
+ * @tparam T type of the data
+ */
+template<typename T>
+class GemmKernel {
+	public:
+#if defined(__AVX512F__)
+		static const unsigned VECTOR_BYTES = 64;
+#elif defined(__AVX__)
+		static const unsigned VECTOR_BYTES = 32;
+#else
+		static const unsigned VECTOR_BYTES = 16;
+#endif
+		static const unsigned LANES = VECTOR_BYTES / sizeof(T);
+		static constexpr unsigned MR = 6;
+		static constexpr unsigned NR = 2 * LANES;
+
+		//Aligned to a cache line, and reused across blocks
+		typedef std::vector<T, PoolAllocator<T>> Buffer;
+
+		/**
+		 * @return the number of elements needed to pack a left operand of the given size
+		 */
+		static std::size_t packedLeftSize(unsigned rows, unsigned depth) {
+			return (std::size_t) roundUp(rows, MR) * depth;
+		}
+
+		/**
+		 * @return the number of elements needed to pack a right operand of the given size
+		 */
+		static std::size_t packedRightSize(unsigned depth, unsigned columns) {
+			return (std::size_t) roundUp(columns, NR) * depth;
+		}
+
+		/**
+		 * Computes C += A * B, where A and B have been packed in panels (see <code>PackedMatrixData</code>).
+		 * @param result row-major matrix of size rows x columns, whose rows are resultStride elements apart
+		 */
+		static void multiply(unsigned rows, unsigned columns, unsigned depth, const T *packedLeft, const T *packedRight,
+							 T *result, unsigned resultStride) {
+			//The right panel (depth x NR) stays in L1 while all the left panels are streamed from L2
+			for (unsigned j = 0; j < columns; j += NR) {
+				const T *b = packedRight + (std::size_t) j * depth;
+				for (unsigned i = 0; i < rows; i += MR) {
+					const T *a = packedLeft + (std::size_t) i * depth;
+					T tile[MR][NR];
+					microKernel(depth, a, b, tile);
+					unsigned tileRows = std::min(MR, rows - i);
+					unsigned tileCols = std::min(NR, columns - j);
+					T *c = result + (std::size_t) i * resultStride + j;
+					for (unsigned r = 0; r < tileRows; r++) {
+						for (unsigned col = 0; col < tileCols; col++) {
+							c[r * resultStride + col] += tile[r][col];
+						}
+					}
+				}
+			}
+		}
+
+	private:
+		static unsigned roundUp(unsigned n, unsigned multiple) {
+			return ((n + multiple - 1) / multiple) * multiple;
+		}
+
+#if defined(__GNUC__)
+		typedef T Vector __attribute__((vector_size(VECTOR_BYTES)));
+
+		/**
+		 * Computes a MRxNR tile, using the vector extensions of GCC/Clang to keep the accumulators in registers
+		 */
+		static void microKernel(unsigned depth, const T *a, const T *b, T (&tile)[MR][NR]) {
+			Vector acc[MR][2];
+			for (unsigned i = 0; i < MR; i++) {
+				acc[i][0] = Vector{};
+				acc[i][1] = Vector{};
+			}
+			for (unsigned p = 0; p < depth; p++) {
+				Vector b0, b1;
+				std::memcpy(&b0, b, VECTOR_BYTES);
+				std::memcpy(&b1, b + LANES, VECTOR_BYTES);
+				for (unsigned i = 0; i < MR; i++) {
+					Vector ai = Vector{} + a[i];
+					acc[i][0] += ai * b0;
+					acc[i][1] += ai * b1;
+				}
+				a += MR;
+				b += NR;
+			}
+			std::memcpy(tile, acc, sizeof(tile));
+		}
+#else
+		static void microKernel(unsigned depth, const T *a, const T *b, T (&tile)[MR][NR]) {
+			for (unsigned i = 0; i < MR; i++) {
+				for (unsigned j = 0; j < NR; j++) {
+					tile[i][j] = 0;
+				}
+			}
+			for (unsigned p = 0; p < depth; p++) {
+				for (unsigned i = 0; i < MR; i++) {
+					for (unsigned j = 0; j < NR; j++) {
+						tile[i][j] += a[i] * b[j];
+					}
+				}
+				a += MR;
+				b += NR;
+			}
+		}
+#endif
+};
+
+template<typename T>
+constexpr unsigned GemmKernel<T>::MR;
+
+template<typename T>
+constexpr unsigned GemmKernel<T>::NR;
+
+#endif //MATRIX_GEMMKERNEL_H
@@ -1,14 +1,20 @@
 #ifndef MATRIX_MATRIX_H
 #define MATRIX_MATRIX_H
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <utility>
 #include <iostream>
+#include <vector>
 #include "MatrixData.h"
 #include "SumMD.h"
+#include "ElementwiseMD.h"
 #include "MultiplyMD.h"
 #include "MatrixIterator.h"
+#include "MatrixSpan.h"
 #include "MatrixCell.h"
+#include "Reduction.h"
 
 
 template<unsigned ROWS, unsigned COLUMNS, typename T, class MD>
@@ -48,6 +54,13 @@ class Matrix {
 
 		Matrix(const Matrix<T, MD> &other) : data(other.data.copy()) {}
 
+		/**
+		 * Creates a matrix that uses the given data (e.g. a <code>FileMatrixData</code>)
+		 */
+		static Matrix<T, MD> fromData(MD data) {
+			return Matrix<T, MD>(data);
+		}
+
 		/**
 		 * Move constructor. Default behaviour.
 		 * @param other the other matrix
@@ -58,6 +71,23 @@ class Matrix {
 			return this->data;
 		}
 
+		/**
+		 * @return the memory layout of this matrix, if it can be described with a base pointer and constant strides
+		 * (e.g. for a matrix, or a submatrix/transposed/diagonal view of it). The returned object is invalid otherwise.
+		 * The memory must not be written, since it could be shared with the copies of this matrix: see writableStrided().
+		 */
+		StridedData<T> strided() const {
+			return this->data.strided();
+		}
+
+		/**
+		 * @return the memory of this matrix, to be written directly, or an invalid object if it must be written cell by cell.
+		 * The memory shared with the copies of this matrix is cloned first.
+		 */
+		StridedData<T> writableStrided() {
+			return this->data.writableStrided();
+		}
+
 		const T operator()(unsigned row, unsigned col) const {
 			if (row < 0 || row >= this->rows()) {
 				Utils::error("Row out of bounds");
@@ -160,6 +190,64 @@ class Matrix {
 			return another + (*this);
 		}
 
+		/**
+		 * Subtracts the given matrix from this one
+		 */
+		template<class MD2>
+		const Matrix<T, ZipMD<T, MD, MD2, std::minus<T>>> operator-(const Matrix<T, MD2> &another) const {
+			return this->zip(another, std::minus<T>());
+		}
+
+		const Matrix<T, MapMD<T, MD, std::negate<T>>> operator-() const {
+			return this->map(std::negate<T>());
+		}
+
+		/**
+		 * Multiplies each cell by the given scalar
+		 */
+		const Matrix<T, MapMD<T, MD, Scale<T>>> operator*(const T &factor) const {
+			return this->map(Scale<T>{factor});
+		}
+
+		/**
+		 * @return the Hadamard (elementwise) product of the two given matrices
+		 */
+		template<class MD2>
+		const Matrix<T, ZipMD<T, MD, MD2, std::multiplies<T>>> hadamard(const Matrix<T, MD2> &another) const {
+			return this->zip(another, std::multiplies<T>());
+		}
+
+		/**
+		 * @return the matrix whose cells are function(cell) for each cell of this one. The function must be pure, since it
+		 * can be called more than once per cell and from many threads.
+		 */
+		template<class F>
+		const Matrix<T, MapMD<T, MD, F>> map(F function) const {
+			return Matrix<T, MapMD<T, MD, F>>(MapMD<T, MD, F>(this->data, function));
+		}
+
+		/**
+		 * @return the matrix whose cells are function(cell of this, cell of another), for two matrices of the same size
+		 */
+		template<class MD2, class F>
+		const Matrix<T, ZipMD<T, MD, MD2, F>> zip(const Matrix<T, MD2> &another, F function) const {
+			return Matrix<T, ZipMD<T, MD, MD2, F>>(ZipMD<T, MD, MD2, F>(this->data, another.data, function));
+		}
+
+		/**
+		 * @return the sum of all the given matrices, which is computed in a single pass
+		 */
+		static const Matrix<T, MultiSumMD<T, MD>> sumOf(const std::vector<Matrix<T, MD>> &matrices) {
+			if (matrices.empty()) {
+				Utils::error("At least a matrix is needed");
+			}
+			std::deque<MD> data;
+			for (auto &matrix : matrices) {
+				data.push_back(matrix.data);
+			}
+			return Matrix<T, MultiSumMD<T, MD>>(MultiSumMD<T, MD>(data));
+		}
+
 		/**
  		 * @return true if this matrix is a square (has the same number of rows and columns)
  		 */
@@ -186,34 +274,170 @@ class Matrix {
 		 * @return an iterator on the first position. This iterator moves from left to right, and then top to bottom.
 		 */
 		MatrixRowMajorIterator<T, MD> beginRowMajor() const {
-			return MatrixRowMajorIterator<T, MD>(this->data, 0, 0);
+			return MatrixRowMajorIterator<T, MD>(&this->data, 0, 0);
 		}
 
 		/**
 		 * @return an iterator on the last position. This iterator moves from left to right, and then top to bottom.
 		 */
 		MatrixRowMajorIterator<T, MD> endRowMajor() const {
-			return MatrixRowMajorIterator<T, MD>(this->data, rows(), 0);
+			return MatrixRowMajorIterator<T, MD>(&this->data, rows(), 0);
 		}
 
 		/**
 		 * @return an iterator on the first position. This iterator moves from top to bottom, and then left to right.
 		 */
 		MatrixColumnMajorIterator<T, MD> beginColumnMajor() const {
-			return MatrixColumnMajorIterator<T, MD>(this->data, 0, 0);
+			return MatrixColumnMajorIterator<T, MD>(&this->data, 0, 0);
 		}
 
 		/**
 		* @return an iterator on the last position. This iterator moves from top to bottom, and then left to right.
 		*/
 		MatrixColumnMajorIterator<T, MD> endColumnMajor() const {
-			return MatrixColumnMajorIterator<T, MD>(this->data, 0, columns());
+			return MatrixColumnMajorIterator<T, MD>(&this->data, 0, columns());
+		}
+
+		/**
+		 * Row-major iteration over the cells, for range-based for and the standard algorithms
+		 */
+		MatrixRowMajorIterator<T, MD> begin() const {
+			return this->beginRowMajor();
+		}
+
+		MatrixRowMajorIterator<T, MD> end() const {
+			return this->endRowMajor();
+		}
+
+		/**
+		 * @return the rows of this matrix, as contiguous spans. Matrices whose rows are not contiguous in memory (e.g. a
+		 * transposed matrix or a product) are materialized a block of rows at a time.
+		 * The range refers to this matrix, which must outlive it.
+		 */
+		MatrixRowSpanRange<T, MD> rowSpans() const {
+			return MatrixRowSpanRange<T, MD>(&this->data);
+		}
+
+		/**
+		 * @return the tiles of this matrix, in row-major order, each with contiguous rows. By default a tile fills about
+		 * half of the L2 cache. The range refers to this matrix, which must outlive it.
+		 */
+		MatrixTileRange<T, MD> tiles(unsigned tileRows = 0, unsigned tileColumns = 0) const {
+			unsigned side = MatrixTileReader<T, MD>::defaultTileSide();
+			return MatrixTileRange<T, MD>(&this->data, tileRows > 0 ? tileRows : side, tileColumns > 0 ? tileColumns : side);
+		}
+
+		/**
+		 * Calls function(tile) for each tile of this matrix, in parallel: the function must be thread-safe
+		 */
+		template<class F>
+		void forEachTile(F function, unsigned tileRows = 0, unsigned tileColumns = 0) const {
+			this->tiles(tileRows, tileColumns).parallelForEach(function);
+		}
+
+		/**
+		 * @return the sum of the cells. Like the other reductions, it reads the matrix in parallel, without creating a
+		 * copy of it (lazy matrices such as products are evaluated a block at a time).
+		 */
+		T sum() const {
+			return Reduction<T>::sum(this->data);
+		}
+
+		/**
+		 * @return the sum of the cells of the diagonal of this squared matrix
+		 */
+		T trace() const {
+			return this->diagonal().sum();
+		}
+
+		/**
+		 * @return the square root of the sum of the squares of the cells
+		 */
+		T frobeniusNorm() const {
+			return (T) std::sqrt(Reduction<T>::sumOfSquares(this->data));
+		}
+
+		/**
+		 * @return the maximum of the sums of the absolute values of the columns
+		 */
+		T norm1() const {
+			return Reduction<T>::maxColumnSum(this->data);
+		}
+
+		/**
+		 * @return the maximum of the sums of the absolute values of the rows
+		 */
+		T normInf() const {
+			return Reduction<T>::maxRowSum(this->data);
+		}
+
+		T min() const {
+			return Reduction<T>::extreme(this->data, std::less<T>()).value;
+		}
+
+		T max() const {
+			return Reduction<T>::extreme(this->data, std::greater<T>()).value;
+		}
+
+		/**
+		 * @return the position (row, column) of the minimum. If there are more, the first in row-major order.
+		 */
+		std::pair<unsigned, unsigned> argmin() const {
+			auto extreme = Reduction<T>::extreme(this->data, std::less<T>());
+			return std::make_pair(extreme.row, extreme.col);
+		}
+
+		/**
+		 * @return the position (row, column) of the maximum. If there are more, the first in row-major order.
+		 */
+		std::pair<unsigned, unsigned> argmax() const {
+			auto extreme = Reduction<T>::extreme(this->data, std::greater<T>());
+			return std::make_pair(extreme.row, extreme.col);
+		}
+
+		/**
+		 * @return the dot product of two vectors, or in general the sum of the products of the cells of two matrices of
+		 * the same size
+		 */
+		template<class MD2>
+		T dot(const Matrix<T, MD2> &another) const {
+			return Reduction<T>::dot(this->data, another.data);
 		}
 
 		Matrix<T, VectorMatrixData<T>> copy() const {
 			return Matrix<T, VectorMatrixData<T>>(VectorMatrixData<T>::template toVector<MD>(this->data));
 		}
 
+		/**
+		 * Evaluates the given expression straight into the memory of this matrix (or view, e.g. a submatrix), without
+		 * allocating a new matrix. If the expression reads the memory that is written (e.g. <code>a.assign(a * b)</code>),
+		 * it's evaluated in a temporary first; elementwise expressions that read each cell only to write the same cell
+		 * (e.g. <code>a.assign(a + b)</code>) don't need it.
+		 * @return this matrix
+		 */
+		template<class MD2>
+		Matrix<T, MD> &assign(const Matrix<T, MD2> &expression) {
+			if (expression.rows() != this->rows() || expression.columns() != this->columns()) {
+				Utils::error("Assignment between incompatible sizes");
+			}
+			unsigned rows = this->rows(), columns = this->columns();
+			StridedData<T> destination = this->data.writableStrided();
+			if (!destination.isValid()) {
+				//The matrix can only be written with set(), e.g. a matrix in a file
+				VectorMatrixData<T> values = VectorMatrixData<T>::toVector(expression.data);
+				for (unsigned r = 0; r < rows; r++) {
+					for (unsigned c = 0; c < columns; c++) {
+						this->data.set(r, c, values.get(r, c));
+					}
+				}
+			} else if (expression.data.virtualAliases(MemoryRegion(destination, rows, columns), true)) {
+				VectorMatrixData<T>::toVector(expression.data).strided().copyTo(rows, columns, destination);
+			} else {
+				expression.data.parallelMaterializeInto(0, 0, rows, columns, destination);
+			}
+			return *this;
+		}
+
 		template<typename U>
 		Matrix<U, MatrixCaster<U, MD>> cast() const {
 			return Matrix<U, MatrixCaster<U, MD>>(MatrixCaster<U, MD>(this->data));
@@ -240,4 +464,12 @@ class Matrix {
 		}
 };
 
+/**
+ * Multiplies each cell of the matrix by the given scalar
+ */
+template<typename T, class MD>
+const Matrix<T, MapMD<T, MD, Scale<T>>> operator*(const typename std::common_type<T>::type &factor, const Matrix<T, MD> &matrix) {
+	return matrix * factor;
+}
+
 #endif //MATRIX_MATRIX_H
@@ -7,7 +7,15 @@
 #include <tuple>
 #include <deque>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <typeinfo>
 #include "Utils.h"
+#include "StridedData.h"
+#include "Allocator.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
 
 template<typename T>
 class VectorMatrixData;
@@ -15,32 +23,60 @@ class VectorMatrixData;
 template<typename T, class MD1, class MD2>
 class MultiplyMD;
 
-//This macro is used to add the method virtualMaterialize() to implementations of MatrixData, without copy-pasting code.
+template<typename T>
+class SparseMatrixData;
+
+//This macro is used to add the methods virtualMaterialize(), virtualMaterializeInto() and virtualGetStrided() to implementations
+//of MatrixData, without copy-pasting code.
 //It is necessary, since this methods call an inherited non-virtual method (i.e. get(r,c))
 #define MATERIALIZE_IMPL        \
-VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const override {\
+void virtualMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns, const StridedData<T> &destination) const override {\
     if (rows < 0 || columns < 0 || rowOffset < 0 || colOffset < 0 || rowOffset + rows > this->rows() || colOffset + columns > this->columns()) {\
         Utils::error("Illegal bounds");\
     }\
-    if (!this->optimizeHasBeenCalled) {\
+    if (!this->optimizeHasBeenCalled.load(std::memory_order_acquire)) {\
         this->optimize();\
     }\
-    VectorMatrixData<T> ret(rows, columns);\
-    for (unsigned r = 0; r < rows; r++) {\
-        for (unsigned c = 0; c < columns; c++) {\
-            ret.set(r, c, this->doGet(r + rowOffset, c + colOffset));\
-        }\
+    Profiler::Scope scope(this, Profiler::current(), true);\
+    Profiler::addBytes((long long) rows * columns * sizeof(T));\
+    StridedData<T> memory = this->strided();\
+    if (memory.isValid()) {\
+        memory.offset(rowOffset, colOffset).copyTo(rows, columns, destination);\
+        return;\
     }\
+    /* Visiting the cells in cache-sized blocks, since the wrapped matrices could be read column-wise */\
+    auto copyCell = [this, destination, rowOffset, colOffset](unsigned r, unsigned c) {\
+        *destination.at(r - rowOffset, c - colOffset) = this->doGet(r, c);\
+    };\
+    BlockedTraversal::traverse(rowOffset, colOffset, rows, columns, copyCell);\
+}\
+\
+VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const override {\
+    VectorMatrixData<T> ret = VectorMatrixData<T>::uninitialized(rows, columns);\
+    this->virtualMaterializeInto(rowOffset, colOffset, rows, columns, ret.strided());\
     return ret;\
 }\
 \
+StridedData<T> virtualGetStrided() const override {\
+    return this->strided();\
+}\
+\
 T get(unsigned row, unsigned col) const {\
-    if (!this->optimizeHasBeenCalled) {\
+    if (!this->optimizeHasBeenCalled.load(std::memory_order_acquire)) {\
         this->optimize();\
     }\
     return this->doGet(row, col);\
 }
 
+//Regions with fewer cells than this are materialized by a single thread, see MatrixData::parallelMaterializeInto()
+const std::size_t PARALLEL_MATERIALIZE_MIN_CELLS = 1 << 16;
+
+/**
+ * Structural identity of an expression (see MatrixData::virtualFingerprint()): the type, the size and the parameters of
+ * each node, followed by the fingerprints of its children. The leaves are identified by their memory.
+ */
+typedef std::vector<std::uintptr_t> Fingerprint;
+
 /**
  * Abstract class that exposes the data of the matrix
  * @tparam T type of the data
@@ -56,7 +92,8 @@ class MatrixData {
 
 	protected:
 
-		mutable bool optimizeHasBeenCalled = false;
+		//Set once optimize() has been called: it's atomic, since the cells can be read by many threads at the same time
+		mutable std::atomic<bool> optimizeHasBeenCalled{false};
 
 		/**
 		 * Adds itself to the multiplication chain
@@ -68,6 +105,16 @@ class MatrixData {
 	public:
 		MatrixData(unsigned rows, unsigned columns) : _rows(rows), _columns(columns) {}
 
+		MatrixData(const MatrixData<T> &another) : _rows(another._rows), _columns(another._columns),
+												   optimizeHasBeenCalled(another.optimizeHasBeenCalled.load(std::memory_order_acquire)) {}
+
+		MatrixData<T> &operator=(const MatrixData<T> &another) {
+			this->_rows = another._rows;
+			this->_columns = another._columns;
+			this->optimizeHasBeenCalled.store(another.optimizeHasBeenCalled.load(std::memory_order_acquire), std::memory_order_release);
+			return *this;
+		}
+
 		virtual ~MatrixData() = default;
 
 		/**
@@ -86,16 +133,98 @@ class MatrixData {
 
 		virtual VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const = 0;
 
+		/**
+		 * Computes the given region of this matrix, writing it directly to the given memory.
+		 * This allows to evaluate an expression (e.g. a sum) straight into its final layout, without temporary matrices.
+		 */
+		virtual void virtualMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+											const StridedData<T> &destination) const = 0;
+
+		/**
+		 * @return the memory layout of this matrix, if it can be described with constant strides, or an invalid object otherwise.
+		 * Implementations that are views over another matrix hide this method, composing the layout of the wrapped matrix.
+		 */
+		StridedData<T> strided() const {
+			return StridedData<T>();
+		}
+
+		/**
+		 * Virtual version of strided(), for when the type of the matrix is not known
+		 */
+		virtual StridedData<T> virtualGetStrided() const = 0;
+
+		/**
+		 * @return the memory of this matrix, to be written directly, or an invalid object if it must be written with set().
+		 * Memory shared with a copy (see <code>VectorMatrixData</code>) is cloned first.
+		 */
+		StridedData<T> writableStrided() {
+			return StridedData<T>();
+		}
+
+		/**
+		 * @return true if writing the given region while this matrix is materialized there could change cells of this
+		 * matrix that have not been read yet, so that the matrix must be materialized in a temporary first.
+		 * sameCells is true when each cell of this matrix is read only to compute the same cell of the region.
+		 * By default, a matrix with a strided layout reads its memory, and the others read their children at any time.
+		 */
+		virtual bool virtualAliases(const MemoryRegion &region, bool sameCells) const {
+			StridedData<T> memory = this->virtualGetStrided();
+			if (memory.isValid()) {
+				return region.aliases(MemoryRegion(memory, this->rows(), this->columns()), sameCells);
+			}
+			for (auto &child : this->virtualGetChildren()) {
+				if (child->virtualAliases(region, false)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/**
+		 * @return this matrix, if it is stored in a sparse format, or NULL. It's used to choose the kernels of the products.
+		 */
+		virtual const SparseMatrixData<T> *virtualGetSparse() const {
+			return NULL;
+		}
+
 		virtual std::vector<const MatrixData<T> *> virtualGetChildren() const {
 			return std::vector<const MatrixData<T> *>();
 		}
 
+		/**
+		 * Appends the fingerprint of this matrix: two matrices with the same fingerprint have the same cells, as long as
+		 * the memory of their leaves is not written. It's used to compute the common subexpressions (e.g. the products) once.
+		 * @return false if the matrix cannot be identified, which is the default (e.g. it exposes memory owned by someone else)
+		 */
+		virtual bool virtualFingerprint(Fingerprint &/*fingerprint*/) const {
+			return false;
+		}
+
 		virtual void virtualOptimize() const {
 			this->optimize();
 		}
 
+		/**
+		 * @return the name of this node, used by the <code>Profiler</code>
+		 */
+		virtual std::string virtualGetName() const {
+			return Profiler::nameOf(typeid(*this));
+		}
+
+		/**
+		 * @return an estimate of the cost of reading a single cell, used to choose the order of the multiplications.
+		 * By default, it is the cost of reading the cell from each child, plus one.
+		 */
+		virtual double virtualGetAccessCost() const {
+			double cost = 1;
+			for (auto &child : this->virtualGetChildren()) {
+				cost += child->virtualGetAccessCost();
+			}
+			return cost;
+		}
+
 		virtual void optimize() const {
-			this->optimizeHasBeenCalled = true;
+			this->optimizeHasBeenCalled.store(true, std::memory_order_release);
 			for (auto &child : this->virtualGetChildren()) {
 				child->virtualOptimize();
 			}
@@ -105,6 +234,55 @@ class MatrixData {
 				child->virtualWaitOptimized();
 			}
 		}
+
+		/**
+		 * Like virtualMaterializeInto(), but a large region is divided in strips of rows (or of columns, if it's short and
+		 * wide) that are evaluated in parallel on the <code>ThreadPool</code>: evaluating an elementwise expression is
+		 * bound by the memory bandwidth, which a single core cannot saturate.
+		 */
+		void parallelMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+									 const StridedData<T> &destination) const {
+			ThreadPool &pool = ThreadPool::instance();
+			std::size_t cells = (std::size_t) rows * columns;
+			unsigned strips = (unsigned) std::min<std::size_t>(4 * pool.workerCount(), cells / PARALLEL_MATERIALIZE_MIN_CELLS);
+			bool byRows = rows >= strips || rows >= columns;
+			strips = std::min(strips, byRows ? rows : columns);
+			if (strips <= 1) {
+				this->virtualMaterializeInto(rowOffset, colOffset, rows, columns, destination);
+				return;
+			}
+			pool.parallelFor(strips, [this, rowOffset, colOffset, rows, columns, &destination, strips, byRows](unsigned strip) {
+				unsigned length = byRows ? rows : columns;
+				unsigned begin = (unsigned) ((unsigned long long) length * strip / strips);
+				unsigned end = (unsigned) ((unsigned long long) length * (strip + 1) / strips);
+				if (byRows) {
+					this->virtualMaterializeInto(rowOffset + begin, colOffset, end - begin, columns, destination.offset(begin, 0));
+				} else {
+					this->virtualMaterializeInto(rowOffset, colOffset + begin, rows, end - begin, destination.offset(0, begin));
+				}
+			});
+		}
+
+	protected:
+		/**
+		 * Appends the type and the size of this matrix, the given parameters and the fingerprints of the children
+		 * @return false if a child cannot be identified
+		 */
+		bool appendFingerprint(Fingerprint &fingerprint, std::initializer_list<std::uintptr_t> parameters = {}) const {
+			//Distinct types have distinct type_info objects, so their addresses cannot be confused
+			fingerprint.push_back(reinterpret_cast<std::uintptr_t>(&typeid(*this)));
+			fingerprint.push_back(this->rows());
+			fingerprint.push_back(this->columns());
+			fingerprint.insert(fingerprint.end(), parameters);
+			std::vector<const MatrixData<T> *> children = this->virtualGetChildren();
+			fingerprint.push_back(children.size());
+			for (auto &child : children) {
+				if (!child->virtualFingerprint(fingerprint)) {
+					return false;
+				}
+			}
+			return true;
+		}
 };
 
 /**
@@ -114,35 +292,180 @@ class MatrixData {
 template<typename T>
 class VectorMatrixData : public MatrixData<T> {
 
+	public:
+		//The storage is aligned to a cache line and comes from the BufferPool
+		typedef std::vector<T, PoolAllocator<T>> Storage;
+
 	private:
-		std::shared_ptr<std::vector<T>> vector;
+		/**
+		 * The storage used by this matrix and by its aliases (the copies of this object held by the views over it).
+		 * Deep copies (see copy()) have their own Buffer, pointing to the same Storage until one of them writes.
+		 */
+		struct Buffer {
+			std::shared_ptr<Storage> storage;
+			T *values;
+			//Identifies the contents of the storage in the fingerprints: it changes when the storage is replaced, or when
+			//it's written after a fingerprint has been taken
+			std::atomic<std::uint64_t> version;
+			std::atomic<bool> fingerprinted{false};
+
+			explicit Buffer(std::shared_ptr<Storage> storage) : storage(storage), values(storage->data()), version(newVersion()) {
+			}
+		};
+
+		std::shared_ptr<Buffer> buffer;
 	public:
 
-		VectorMatrixData(unsigned rows, unsigned columns, std::shared_ptr<std::vector<T>> vector) : MatrixData<T>(rows, columns), vector(vector) {
+		VectorMatrixData(unsigned rows, unsigned columns, std::shared_ptr<Storage> vector) :
+				MatrixData<T>(rows, columns), buffer(std::make_shared<Buffer>(vector)) {
 		}
 
-		VectorMatrixData(unsigned rows, unsigned columns) : MatrixData<T>(rows, columns), vector(std::make_shared<std::vector<T >>(rows * columns)) {
+		/**
+		 * Creates a matrix filled with zeros
+		 */
+		VectorMatrixData(unsigned rows, unsigned columns) :
+				VectorMatrixData<T>(rows, columns, std::make_shared<Storage>((std::size_t) rows * columns, T())) {
+		}
+
+		/**
+		 * Creates a matrix whose cells are not initialized, to be used when all of them are going to be overwritten
+		 */
+		static VectorMatrixData<T> uninitialized(unsigned rows, unsigned columns) {
+			return VectorMatrixData<T>(rows, columns, std::make_shared<Storage>((std::size_t) rows * columns));
 		}
 
 		MATERIALIZE_IMPL
 
 		void set(unsigned row, unsigned col, T t) {
-			(*this->vector.get())[row * this->columns() + col] = t;
+			this->detach();
+			if (this->buffer->fingerprinted.load(std::memory_order_relaxed)) {
+				this->changeVersion();
+			}
+			this->buffer->values[row * this->columns() + col] = t;
+		}
+
+		/**
+		 * The memory must not be written, since it could be shared with the copies of this matrix
+		 */
+		StridedData<T> strided() const {
+			return StridedData<T>(this->buffer->values, this->columns(), 1);
+		}
+
+		/**
+		 * The memory is going to be written, so the fingerprints taken before this call don't identify it anymore
+		 */
+		StridedData<T> writableStrided() {
+			this->detach();
+			this->changeVersion();
+			return this->strided();
+		}
+
+		/**
+		 * A matrix is identified by its memory, and by the version of its contents
+		 */
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			this->buffer->fingerprinted.store(true, std::memory_order_relaxed);
+			return this->appendFingerprint(fingerprint, {reinterpret_cast<std::uintptr_t>(this->buffer->values),
+														 (std::uintptr_t) this->buffer->version.load(std::memory_order_relaxed)});
 		}
 
+		/**
+		 * @return true if the storage is shared with a copy of this matrix, so the next write is going to clone it
+		 */
+		bool isShared() const {
+			return this->buffer->storage.use_count() > 1;
+		}
+
+		/**
+		 * Copy-on-write: the copy shares the storage with this matrix, which is cloned by the first of the two that writes
+		 */
 		VectorMatrixData<T> copy() const {
-			//std::cout << "copying" << std::endl;
-			return VectorMatrixData<T>(this->rows(), this->columns(), std::make_shared<std::vector<T>>(*this->vector.get()));
+			return VectorMatrixData<T>(this->rows(), this->columns(), this->buffer->storage);
 		}
 
+		/**
+		 * Evaluates the given matrix in a new one, in parallel if it's large
+		 */
 		template<class MD>
-		static VectorMatrixData<T> toVector(MD matrixData) {
-			return matrixData.virtualMaterialize(0, 0, matrixData.rows(), matrixData.columns());
+		static VectorMatrixData<T> toVector(const MD &matrixData) {
+			VectorMatrixData<T> ret = VectorMatrixData<T>::uninitialized(matrixData.rows(), matrixData.columns());
+			matrixData.parallelMaterializeInto(0, 0, matrixData.rows(), matrixData.columns(), ret.strided());
+			return ret;
 		}
 
 	private:
 		T doGet(unsigned row, unsigned col) const {
-			return (*this->vector.get())[row * this->columns() + col];
+			return this->buffer->values[row * this->columns() + col];
+		}
+
+		/**
+		 * Clones the storage if it is shared with a copy, so that the writes of this matrix (and of its views) are not
+		 * seen by the copy
+		 */
+		void detach() {
+			if (this->buffer->storage.use_count() == 1) {
+				//The other owners could have just released the storage: their reads happen before our writes
+				std::atomic_thread_fence(std::memory_order_acquire);
+				return;
+			}
+			auto storage = std::make_shared<Storage>(*this->buffer->storage);
+			this->buffer->storage = storage;
+			this->buffer->values = storage->data();
+			//The new storage could have the address of a freed one
+			this->changeVersion();
+		}
+
+		void changeVersion() {
+			this->buffer->fingerprinted.store(false, std::memory_order_relaxed);
+			this->buffer->version.store(newVersion(), std::memory_order_relaxed);
+		}
+
+		/**
+		 * The versions are unique in the whole program, so that a storage allocated where a freed one was has a different
+		 * fingerprint
+		 */
+		static std::uint64_t newVersion() {
+			static std::atomic<std::uint64_t> next{0};
+			return next.fetch_add(1, std::memory_order_relaxed);
+		}
+};
+
+/**
+ * Implementation of <code>MatrixData</code> that exposes memory owned by someone else (e.g. a region of a buffer),
+ * which must outlive it. Its copies share the memory.
+ * @tparam T type of the data
+ */
+template<typename T>
+class StridedMD : public MatrixData<T> {
+
+	private:
+		StridedData<T> memory;
+
+	public:
+		StridedMD(StridedData<T> memory, unsigned rows, unsigned columns) : MatrixData<T>(rows, columns), memory(memory) {
+		}
+
+		MATERIALIZE_IMPL
+
+		void set(unsigned row, unsigned col, T t) {
+			*this->memory.at(row, col) = t;
+		}
+
+		StridedData<T> strided() const {
+			return this->memory;
+		}
+
+		StridedData<T> writableStrided() {
+			return this->memory;
+		}
+
+		StridedMD<T> copy() const {
+			return *this;
+		}
+
+	private:
+		T doGet(unsigned row, unsigned col) const {
+			return *this->memory.at(row, col);
 		}
 };
 
@@ -160,6 +483,10 @@ class SingleMatrixWrapper : public MatrixData<T> {
 		SingleMatrixWrapper(MD wrapped, unsigned rows, unsigned columns) : MatrixData<T>(rows, columns), wrapped(wrapped) {
 		}
 
+		const MD &getWrapped() const {
+			return this->wrapped;
+		}
+
 		std::vector<const MatrixData<T> *> virtualGetChildren() const override {
 			return {&this->wrapped};
 		}
@@ -180,6 +507,14 @@ class BiMatrixWrapper : public MatrixData<T> {
 		BiMatrixWrapper(MD1 left, MD2 right, unsigned rows, unsigned columns) : MatrixData<T>(rows, columns), left(left), right(right) {
 		}
 
+		const MD1 &getLeft() const {
+			return this->left;
+		}
+
+		const MD2 &getRight() const {
+			return this->right;
+		}
+
 		std::vector<const MatrixData<T> *> virtualGetChildren() const override {
 			const MatrixData<T> *left = &this->left;
 			const MatrixData<T> *right = &this->right;
@@ -244,6 +579,18 @@ class SubmatrixMD : public SingleMatrixWrapper<T, MD> {
 			this->wrapped.set(row + this->rowOffset, col + this->colOffset, t);
 		}
 
+		StridedData<T> strided() const {
+			return this->wrapped.strided().offset(this->rowOffset, this->colOffset);
+		}
+
+		StridedData<T> writableStrided() {
+			return this->wrapped.writableStrided().offset(this->rowOffset, this->colOffset);
+		}
+
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint, {this->rowOffset, this->colOffset});
+		}
+
 		SubmatrixMD<T, MD> copy() const {
 			return SubmatrixMD<T, MD>(this->rowOffset, this->colOffset, this->rows(), this->columns(), this->wrapped.copy());
 		}
@@ -272,6 +619,18 @@ class TransposedMD : public SingleMatrixWrapper<T, MD> {
 			this->wrapped.set(col, row, t);
 		}
 
+		StridedData<T> strided() const {
+			return this->wrapped.strided().transposed();
+		}
+
+		StridedData<T> writableStrided() {
+			return this->wrapped.writableStrided().transposed();
+		}
+
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint);
+		}
+
 		TransposedMD<T, MD> copy() const {
 			return TransposedMD<T, MD>(this->wrapped.copy());
 		}
@@ -303,6 +662,18 @@ class DiagonalMD : public SingleMatrixWrapper<T, MD> {
 			this->wrapped.set(row, row, t);
 		}
 
+		StridedData<T> strided() const {
+			return this->wrapped.strided().diagonal();
+		}
+
+		StridedData<T> writableStrided() {
+			return this->wrapped.writableStrided().diagonal();
+		}
+
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint);
+		}
+
 		DiagonalMD<T, MD> copy() const {
 			return DiagonalMD<T, MD>(this->wrapped.copy());
 		}
@@ -330,6 +701,10 @@ class DiagonalMatrixMD : public SingleMatrixWrapper<T, MD> {
 
 		MATERIALIZE_IMPL
 
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint);
+		}
+
 		DiagonalMatrixMD<T, MD> copy() const {
 			return DiagonalMatrixMD<T, MD>(this->wrapped.copy());
 		}
@@ -354,54 +729,101 @@ class DiagonalMatrixMD : public SingleMatrixWrapper<T, MD> {
  * A|B
  * C|D
  *
+ * The blocks at the edges can be smaller: if B were 2x1, C 1x2 and D 1x1, the matrix would be 3x3.
+ *
  * @tparam T
  * @tparam MD
  */
 template<typename T, class MD>
 class ConcatenationMD : public MultiMatrixWrapper<T, MD> {
 	public:
+		/**
+		 * The blocks are in row-major order. They must have the same size, except the ones in the last row of blocks,
+		 * that can have fewer rows, and the ones in the last column of blocks, that can have fewer columns.
+		 */
 		explicit ConcatenationMD(std::deque<MD> blocks, unsigned rows, unsigned columns) :
 				MultiMatrixWrapper<T, MD>(blocks, rows, columns) {
-			//Checking that all the blocks have the same size
 			unsigned blockRows = this->getRowsOfBlocks();
 			unsigned blockCols = this->getColumnsOfBlocks();
-			for (auto &block: blocks) {
-				if (block.rows() != blockRows || block.columns() != blockCols) {
-					Utils::error("All the matrices must be of the same size!");
-				}
+			unsigned rowBlocks = this->getNumberOfRowBlocks(), columnBlocks = this->getNumberOfColumnBlocks();
+			if (rowBlocks * columnBlocks != blocks.size()) {
+				Utils::error("The number of blocks (" + std::to_string(blocks.size()) + ") doesn't cover the whole matrix");
 			}
-			if (rows % blockRows != 0) {
-				Utils::error("The number of rows (" + std::to_string(rows) + ") must be a multiple of the number of rows of the blocks (" +
-							 std::to_string(blockRows) + ")!");
-			} else if (columns % blockCols != 0) {
-				Utils::error("The number of cols (" + std::to_string(columns) + ") must be a multiple of the number of cols of the blocks (" +
-							 std::to_string(blockCols) + ")!");
-			} else if ((rows / blockRows) * (columns / blockCols) != blocks.size()) {
-				Utils::error("The number of blocks (" + std::to_string(blocks.size()) + ") is not enough to cover the whole matrix");
+			//Checking that every block has the size of its position in the grid
+			for (unsigned r = 0; r < rowBlocks; r++) {
+				for (unsigned c = 0; c < columnBlocks; c++) {
+					const MD &block = this->wrapped[r * columnBlocks + c];
+					if (block.rows() != std::min(blockRows, rows - r * blockRows) ||
+						block.columns() != std::min(blockCols, columns - c * blockCols)) {
+						Utils::error("The block (" + std::to_string(r) + ", " + std::to_string(c) + ") has the wrong size");
+					}
+				}
 			}
 		}
 
 		/**
 		 * @return the number of vertical blocks
 		 */
-		unsigned getNumberOfColumnBlocks() const { return this->columns() / this->getColumnsOfBlocks(); }
+		unsigned getNumberOfColumnBlocks() const { return Utils::ceilDiv(this->columns(), this->getColumnsOfBlocks()); }
 
 		/**
 		 * @return the number of horizontal blocks
 		 */
-		unsigned getNumberOfRowBlocks() const { return this->rows() / this->getRowsOfBlocks(); }
+		unsigned getNumberOfRowBlocks() const { return Utils::ceilDiv(this->rows(), this->getRowsOfBlocks()); }
 
 		/**
-		 * @return the number of rows of each block
+		 * @return the number of rows of each block, except the last row of blocks
 		 */
 		unsigned getRowsOfBlocks() const { return this->wrapped[0].rows(); }
 
 		/**
-		 * @return the number of columns of each block
+		 * @return the number of columns of each block, except the last column of blocks
 		 */
 		unsigned getColumnsOfBlocks() const { return this->wrapped[0].columns(); }
 
-		MATERIALIZE_IMPL
+		/**
+		 * Materializes the region one block at a time, so that each block copies its own memory
+		 */
+		void virtualMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+									const StridedData<T> &destination) const override {
+			if (rowOffset + rows > this->rows() || colOffset + columns > this->columns()) {
+				Utils::error("Illegal bounds");
+			}
+			if (!this->optimizeHasBeenCalled.load(std::memory_order_acquire)) {
+				this->optimize();
+			}
+			unsigned blockRows = this->getRowsOfBlocks(), blockCols = this->getColumnsOfBlocks();
+			for (unsigned row = rowOffset; row < rowOffset + rows;) {
+				unsigned blockRow = row / blockRows, rowInBlock = row % blockRows;
+				unsigned rowCount = std::min(blockRows - rowInBlock, rowOffset + rows - row);
+				for (unsigned col = colOffset; col < colOffset + columns;) {
+					unsigned blockCol = col / blockCols, colInBlock = col % blockCols;
+					unsigned colCount = std::min(blockCols - colInBlock, colOffset + columns - col);
+					const MD &block = this->wrapped[blockRow * this->getNumberOfColumnBlocks() + blockCol];
+					block.virtualMaterializeInto(rowInBlock, colInBlock, rowCount, colCount,
+												 destination.offset(row - rowOffset, col - colOffset));
+					col += colCount;
+				}
+				row += rowCount;
+			}
+		}
+
+		VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const override {
+			VectorMatrixData<T> ret = VectorMatrixData<T>::uninitialized(rows, columns);
+			this->virtualMaterializeInto(rowOffset, colOffset, rows, columns, ret.strided());
+			return ret;
+		}
+
+		StridedData<T> virtualGetStrided() const override {
+			return this->strided();
+		}
+
+		T get(unsigned row, unsigned col) const {
+			if (!this->optimizeHasBeenCalled.load(std::memory_order_acquire)) {
+				this->optimize();
+			}
+			return this->doGet(row, col);
+		}
 
 		DiagonalMatrixMD<T, MD> copy() const {
 			return ConcatenationMD<T, MD>(this->copyWrapped());
@@ -420,32 +842,6 @@ class ConcatenationMD : public MultiMatrixWrapper<T, MD> {
 
 };
 
-/**
- * Resize the given matrix to a new matrix of the given size.
- * Elements outside of the bounds of the given matrices are 0.
- */
-template<typename T, class MD>
-class ResizerMD : public SingleMatrixWrapper<T, MD> {
-	public:
-		ResizerMD(MD wrapped, unsigned rows, unsigned columns) : SingleMatrixWrapper<T, MD>(wrapped, rows, columns) {
-		}
-
-		MATERIALIZE_IMPL
-
-		ResizerMD<T, MD> copy() const {
-			return ResizerMD<T, MD>(this->wrapped.copy(), this->rows(), this->columns());
-		}
-
-	private:
-		T doGet(unsigned row, unsigned col) const {
-			if (row < this->wrapped.rows() && col < this->wrapped.columns()) {
-				return this->wrapped.get(row, col);
-			} else {
-				return 0;
-			}
-		}
-};
-
 template<typename T, class MD>
 class MatrixCaster : public MatrixData<T> {
 
@@ -483,6 +879,18 @@ class MatrixCaster : public MatrixData<T> {
 			return std::vector<const MatrixData<T> *>();
 		}
 
+		double virtualGetAccessCost() const override {
+			return 1 + this->wrapped.virtualGetAccessCost();
+		}
+
+		bool virtualAliases(const MemoryRegion &region, bool sameCells) const override {
+			return this->wrapped.virtualAliases(region, sameCells);
+		}
+
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint) && this->wrapped.virtualFingerprint(fingerprint);
+		}
+
 	private:
 		T doGet(unsigned row, unsigned col) const {
 			return this->wrapped.get(row, col);
@@ -1,24 +1,37 @@
 #ifndef MATRIX_MATRIXITERATOR_H
 #define MATRIX_MATRIXITERATOR_H
 
+#include <iterator>
 #include <memory>
 #include "MatrixData.h"
 
 /**
- * Base iterator with common methods
+ * Base iterator with common methods.
+ * It refers to the data of the matrix, which must outlive it: copying the data in each iterator would lose the cached
+ * results of the lazy matrices. When the matrix has a strided layout, the cells are read directly from its memory.
  * @tparam T type of data
  */
 template<typename T, class MD>
 class BaseMatrixIterator {
 	protected:
-		MD data;
+		const MD *data;
+		StridedData<T> memory;
 		unsigned row, col;
 
 	public:
-		BaseMatrixIterator(MD data, unsigned row, unsigned col) : data(data), row(row), col(col) {}
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const T *pointer;
+		typedef T reference;
 
-		T operator*() {
-			return data.get(row, col);
+		BaseMatrixIterator(const MD *data, unsigned row, unsigned col) : data(data), memory(data->strided()), row(row), col(col) {}
+
+		T operator*() const {
+			if (this->memory.isValid()) {
+				return *this->memory.at(row, col);
+			}
+			return data->get(row, col);
 		}
 
 		bool operator==(const BaseMatrixIterator<T, MD> &other) const {
@@ -37,25 +50,27 @@ class BaseMatrixIterator {
 template<typename T, class MD>
 class MatrixRowMajorIterator : public BaseMatrixIterator<T, MD> {
 	public:
-		MatrixRowMajorIterator(MD data, unsigned row, unsigned col) : BaseMatrixIterator<T, MD>(data, row,
+		MatrixRowMajorIterator(const MD *data, unsigned row, unsigned col) : BaseMatrixIterator<T, MD>(data, row,
 																										col) {}
 
-		void operator++() {
-			if (this->col + 1 >= this->data.columns()) {
+		MatrixRowMajorIterator<T, MD> &operator++() {
+			if (this->col + 1 >= this->data->columns()) {
 				this->row++;
 				this->col = 0;
 			} else {
 				this->col++;
 			}
+			return *this;
 		}
 
-		void operator--() {
+		MatrixRowMajorIterator<T, MD> &operator--() {
 			if (this->col == 0) {
 				this->row--;
-				this->col = this->data.columns() - 1;
+				this->col = this->data->columns() - 1;
 			} else {
 				this->col--;
 			}
+			return *this;
 		}
 
 };
@@ -67,25 +82,27 @@ class MatrixRowMajorIterator : public BaseMatrixIterator<T, MD> {
 template<typename T, class MD>
 class MatrixColumnMajorIterator : public BaseMatrixIterator<T, MD> {
 	public:
-		MatrixColumnMajorIterator(MD data, unsigned row, unsigned col) : BaseMatrixIterator<T, MD>(data, row,
+		MatrixColumnMajorIterator(const MD *data, unsigned row, unsigned col) : BaseMatrixIterator<T, MD>(data, row,
 																										   col) {}
 
-		void operator++() {
-			if (this->row + 1 >= this->data.rows()) {
+		MatrixColumnMajorIterator<T, MD> &operator++() {
+			if (this->row + 1 >= this->data->rows()) {
 				this->col++;
 				this->row = 0;
 			} else {
 				this->row++;
 			}
+			return *this;
 		}
 
-		void operator--() {
+		MatrixColumnMajorIterator<T, MD> &operator--() {
 			if (this->row == 0) {
 				this->col--;
-				this->row = this->data.rows() - 1;
+				this->row = this->data->rows() - 1;
 			} else {
 				this->row--;
 			}
+			return *this;
 		}
 
 };
@@ -0,0 +1,327 @@
+#ifndef MATRIX_MATRIXSPAN_H
+#define MATRIX_MATRIXSPAN_H
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include "MatrixData.h"
+#include "ThreadPool.h"
+#include "Tuning.h"
+
+/**
+ * A run of contiguous cells of a row of a matrix, starting at the cell (row, col). It can be read as an array, e.g. with
+ * a range-based for or the standard algorithms.
+ * @tparam T type of the data
+ */
+template<typename T>
+class MatrixSpan {
+	private:
+		const T *first;
+		unsigned length, _row, _col;
+
+	public:
+		MatrixSpan(const T *first, unsigned length, unsigned row, unsigned col) : first(first), length(length), _row(row), _col(col) {
+		}
+
+		const T *begin() const {
+			return this->first;
+		}
+
+		const T *end() const {
+			return this->first + this->length;
+		}
+
+		const T *data() const {
+			return this->first;
+		}
+
+		unsigned size() const {
+			return this->length;
+		}
+
+		T operator[](unsigned i) const {
+			return this->first[i];
+		}
+
+		/**
+		 * @return the row of the matrix the span belongs to
+		 */
+		unsigned row() const {
+			return this->_row;
+		}
+
+		/**
+		 * @return the column of the matrix of the first cell of the span
+		 */
+		unsigned col() const {
+			return this->_col;
+		}
+};
+
+/**
+ * A rectangular region of a matrix, whose rows are contiguous in memory: it points to the memory of the matrix when its
+ * layout allows it, or to a buffer where the region has been materialized otherwise.
+ * The memory must not be written.
+ * @tparam T type of the data
+ */
+template<typename T>
+class MatrixTile {
+	private:
+		StridedData<T> memory;
+		unsigned _rowOffset, _colOffset, _rows, _columns;
+
+	public:
+		MatrixTile(StridedData<T> memory, unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) :
+				memory(memory), _rowOffset(rowOffset), _colOffset(colOffset), _rows(rows), _columns(columns) {
+		}
+
+		unsigned rowOffset() const {
+			return this->_rowOffset;
+		}
+
+		unsigned colOffset() const {
+			return this->_colOffset;
+		}
+
+		unsigned rows() const {
+			return this->_rows;
+		}
+
+		unsigned columns() const {
+			return this->_columns;
+		}
+
+		/**
+		 * @return the cell (row, col) of the tile, i.e. the cell (rowOffset() + row, colOffset() + col) of the matrix
+		 */
+		T operator()(unsigned row, unsigned col) const {
+			return *this->memory.at(row, col);
+		}
+
+		/**
+		 * @return the given row of the tile
+		 */
+		MatrixSpan<T> row(unsigned row) const {
+			return MatrixSpan<T>(this->memory.at(row, 0), this->_columns, this->_rowOffset + row, this->_colOffset);
+		}
+
+		/**
+		 * @return the memory of the tile, with contiguous rows
+		 */
+		StridedData<T> strided() const {
+			return this->memory;
+		}
+};
+
+/**
+ * Reads regions of a matrix as <code>MatrixTile</code>: the regions of matrices with contiguous rows are exposed in
+ * place, the others are materialized in a buffer, which is reused by the next region unless a copy of the reader still
+ * uses it
+ * @tparam T type of the data
+ * @tparam MD type of the matrix
+ */
+template<typename T, class MD>
+class MatrixTileReader {
+	private:
+		const MD *data;
+		std::shared_ptr<typename VectorMatrixData<T>::Storage> buffer;
+
+	public:
+		explicit MatrixTileReader(const MD *data) : data(data) {
+		}
+
+		MatrixTile<T> read(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) {
+			StridedData<T> memory = this->data->strided();
+			if (memory.isValid() && memory.hasContiguousRows()) {
+				return MatrixTile<T>(memory.offset(rowOffset, colOffset), rowOffset, colOffset, rows, columns);
+			}
+			std::size_t size = (std::size_t) rows * columns;
+			if (!this->buffer || this->buffer.use_count() > 1 || this->buffer->size() < size) {
+				this->buffer = std::make_shared<typename VectorMatrixData<T>::Storage>(size);
+			}
+			StridedData<T> destination(this->buffer->data(), columns, 1);
+			this->data->virtualMaterializeInto(rowOffset, colOffset, rows, columns, destination);
+			return MatrixTile<T>(destination, rowOffset, colOffset, rows, columns);
+		}
+
+		/**
+		 * @return the side of the default tiles, so that a tile fills about half of the L2 cache
+		 */
+		static unsigned defaultTileSide() {
+			std::size_t cells = Tuning::instance().cacheSizes().l2 / 2 / sizeof(T);
+			return std::max(16u, (unsigned) std::sqrt((double) cells) / 16 * 16);
+		}
+};
+
+/**
+ * Iterator over the tiles of a matrix, in row-major order. The last tiles of each row and column can be smaller.
+ * @tparam T type of the data
+ * @tparam MD type of the matrix
+ */
+template<typename T, class MD>
+class MatrixTileIterator {
+	private:
+		MatrixTileReader<T, MD> reader;
+		unsigned rows, columns, tileRows, tileColumns, index;
+
+		unsigned tilesPerRow() const {
+			return Utils::ceilDiv(this->columns, this->tileColumns);
+		}
+
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef MatrixTile<T> value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const MatrixTile<T> *pointer;
+		typedef MatrixTile<T> reference;
+
+		MatrixTileIterator(const MD *data, unsigned tileRows, unsigned tileColumns, unsigned index) :
+				reader(data), rows(data->rows()), columns(data->columns()), tileRows(tileRows), tileColumns(tileColumns), index(index) {
+		}
+
+		/**
+		 * Reads the current tile. It can be materialized, so it's better to read it once.
+		 */
+		MatrixTile<T> operator*() {
+			unsigned rowOffset = this->index / this->tilesPerRow() * this->tileRows;
+			unsigned colOffset = this->index % this->tilesPerRow() * this->tileColumns;
+			return this->reader.read(rowOffset, colOffset, std::min(this->tileRows, this->rows - rowOffset),
+									 std::min(this->tileColumns, this->columns - colOffset));
+		}
+
+		MatrixTileIterator<T, MD> &operator++() {
+			this->index++;
+			return *this;
+		}
+
+		bool operator==(const MatrixTileIterator<T, MD> &other) const {
+			return this->index == other.index;
+		}
+
+		bool operator!=(const MatrixTileIterator<T, MD> &other) const {
+			return !(*this == other);
+		}
+};
+
+/**
+ * Iterator over the rows of a matrix, as <code>MatrixSpan</code>. Matrices without contiguous rows are materialized a
+ * block of rows at a time.
+ * @tparam T type of the data
+ * @tparam MD type of the matrix
+ */
+template<typename T, class MD>
+class MatrixRowSpanIterator {
+	private:
+		MatrixTileReader<T, MD> reader;
+		unsigned rows, columns, blockRows, row;
+		//The block of rows that contains the current row, if it has been read
+		MatrixTile<T> block;
+		bool hasBlock;
+
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef MatrixSpan<T> value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const MatrixSpan<T> *pointer;
+		typedef MatrixSpan<T> reference;
+
+		MatrixRowSpanIterator(const MD *data, unsigned row) :
+				reader(data), rows(data->rows()), columns(data->columns()), row(row),
+				block(StridedData<T>(), 0, 0, 0, 0), hasBlock(false) {
+			std::size_t cells = Tuning::instance().cacheSizes().l2 / 2 / sizeof(T);
+			this->blockRows = (unsigned) std::max<std::size_t>(1, cells / std::max(1u, this->columns));
+		}
+
+		MatrixSpan<T> operator*() {
+			if (!this->hasBlock || this->row >= this->block.rowOffset() + this->block.rows()) {
+				this->block = this->reader.read(this->row, 0, std::min(this->blockRows, this->rows - this->row), this->columns);
+				this->hasBlock = true;
+			}
+			return this->block.row(this->row - this->block.rowOffset());
+		}
+
+		MatrixRowSpanIterator<T, MD> &operator++() {
+			this->row++;
+			return *this;
+		}
+
+		bool operator==(const MatrixRowSpanIterator<T, MD> &other) const {
+			return this->row == other.row;
+		}
+
+		bool operator!=(const MatrixRowSpanIterator<T, MD> &other) const {
+			return !(*this == other);
+		}
+};
+
+/**
+ * Range of the rows of a matrix, see <code>Matrix::rowSpans()</code>
+ */
+template<typename T, class MD>
+class MatrixRowSpanRange {
+	private:
+		const MD *data;
+
+	public:
+		explicit MatrixRowSpanRange(const MD *data) : data(data) {
+		}
+
+		MatrixRowSpanIterator<T, MD> begin() const {
+			return MatrixRowSpanIterator<T, MD>(this->data, 0);
+		}
+
+		MatrixRowSpanIterator<T, MD> end() const {
+			return MatrixRowSpanIterator<T, MD>(this->data, this->data->rows());
+		}
+};
+
+/**
+ * Range of the tiles of a matrix, see <code>Matrix::tiles()</code>
+ */
+template<typename T, class MD>
+class MatrixTileRange {
+	private:
+		const MD *data;
+		unsigned tileRows, tileColumns;
+
+	public:
+		MatrixTileRange(const MD *data, unsigned tileRows, unsigned tileColumns) :
+				data(data), tileRows(tileRows), tileColumns(tileColumns) {
+		}
+
+		/**
+		 * @return the number of tiles
+		 */
+		unsigned size() const {
+			return Utils::ceilDiv(this->data->rows(), this->tileRows) * Utils::ceilDiv(this->data->columns(), this->tileColumns);
+		}
+
+		MatrixTileIterator<T, MD> begin() const {
+			return MatrixTileIterator<T, MD>(this->data, this->tileRows, this->tileColumns, 0);
+		}
+
+		MatrixTileIterator<T, MD> end() const {
+			return MatrixTileIterator<T, MD>(this->data, this->tileRows, this->tileColumns, this->size());
+		}
+
+		/**
+		 * Calls function(tile) for each tile, in parallel on the <code>ThreadPool</code>: the function must be thread-safe.
+		 * Each task reads a contiguous range of tiles, with its own buffer.
+		 */
+		template<class F>
+		void parallelForEach(F function) const {
+			unsigned tiles = this->size();
+			unsigned tasks = std::min(tiles, 4 * ThreadPool::instance().workerCount());
+			MatrixTileRange<T, MD> range = *this;
+			ThreadPool::instance().parallelFor(tasks, [&range, &function, tiles, tasks](unsigned task) {
+				MatrixTileIterator<T, MD> it(range.data, range.tileRows, range.tileColumns, (unsigned) ((unsigned long long) tiles * task / tasks));
+				MatrixTileIterator<T, MD> end(range.data, range.tileRows, range.tileColumns, (unsigned) ((unsigned long long) tiles * (task + 1) / tasks));
+				for (; it != end; ++it) {
+					function(*it);
+				}
+			});
+		}
+};
+
+#endif //MATRIX_MATRIXSPAN_H
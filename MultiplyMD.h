@@ -7,14 +7,19 @@
 
 #include "MatrixData.h"
 #include "OptimizableMD.h"
-#include "MaterializerMD.h"
+#include "PackedMD.h"
+#include "SparseMD.h"
+#include "GemmKernel.h"
+#include "Reduction.h"
+#include "Tuning.h"
 #include <deque>
 #include <cmath>
 #include <chrono>
 #include <thread>
 
-//Using long, blocks of 128k will be 128x128
-unsigned OPTIMAL_BLOCK_SIZE = 128 * 1024;
+//Chains of multiplications up to this length are ordered optimally with dynamic programming, which is O(n^3).
+//Longer chains use a greedy heuristic.
+unsigned MAX_OPTIMAL_CHAIN_LENGTH = 256;
 
 template<typename T>
 class OptimizedMultiplyMD;
@@ -22,6 +27,108 @@ class OptimizedMultiplyMD;
 template<typename T>
 class BaseMultiplyMD;
 
+/**
+ * A multiplication that is not computed by the packed kernel, but by kernels of its own, one block of rows at a time
+ * (e.g. when an operand is sparse). It's shared by the blocks of its result.
+ */
+template<typename T>
+class RowBlockProduct {
+	public:
+		unsigned rows = 0, columns = 0;
+		//If true, the product computes the transpose of the result, whose blocks are then blocks of columns
+		bool transposedResult = false;
+
+		virtual ~RowBlockProduct() = default;
+
+		/**
+		 * Writes the given rows of the product to the result, which is zero
+		 * @return the number of floating point operations
+		 */
+		virtual long long multiplyRows(unsigned rowOffset, unsigned rows, const StridedData<T> &result) const = 0;
+};
+
+/**
+ * A multiplication where one of the operands is sparse, computed by the kernels of <code>SparseMatrixData</code>
+ */
+template<typename T>
+class SparseProduct : public RowBlockProduct<T> {
+	public:
+		const SparseMatrixData<T> *sparse = NULL;
+		bool sparseOnLeft = true;
+		//The other operand, and its materialization when it has no strided layout
+		StridedData<T> dense;
+		std::shared_ptr<VectorMatrixData<T>> denseStorage;
+
+		long long multiplyRows(unsigned rowOffset, unsigned rows, const StridedData<T> &result) const override {
+			if (this->sparseOnLeft) {
+				return 2 * this->sparse->multiplyDense(rowOffset, rows, this->dense, this->columns, result);
+			}
+			return 2 * this->sparse->multiplyByDense(this->dense.offset(rowOffset, 0), rows, result);
+		}
+};
+
+/**
+ * The product of a matrix by a vector (GEMV). The product of a covector by a matrix (GEVM) is computed as the transpose of
+ * the product of the transposed matrix by the vector.
+ * It's bound by the memory bandwidth, so the matrix is read once, in the order of its layout: by rows with a dot product
+ * per row, or by columns accumulating each column, scaled by a cell of the vector, on a block of the result.
+ */
+template<typename T>
+class VectorProduct : public RowBlockProduct<T> {
+	public:
+		//The matrix (without the transposition, for a GEMV), and its memory if it has a strided layout
+		const MatrixData<T> *matrix = NULL;
+		StridedData<T> memory;
+		//The cells of the vector, contiguous
+		const T *vector = NULL;
+		std::shared_ptr<VectorMatrixData<T>> vectorStorage;
+		unsigned depth = 0;
+
+		long long multiplyRows(unsigned rowOffset, unsigned rows, const StridedData<T> &result) const override {
+			StridedData<T> memory = this->memory;
+			VectorMatrixData<T> block(0, 0);
+			if (memory.isValid() && (memory.colStride == 1 || memory.rowStride == 1)) {
+				memory = memory.offset(rowOffset, 0);
+			} else {
+				//Each block materializes only the rows it needs, so the matrix is materialized in parallel
+				if (this->transposedResult) {
+					block = this->matrix->virtualMaterialize(0, rowOffset, this->depth, rows);
+					memory = block.strided().transposed();
+				} else {
+					block = this->matrix->virtualMaterialize(rowOffset, 0, rows, this->depth);
+					memory = block.strided();
+				}
+			}
+			if (memory.colStride == 1) {
+				for (unsigned r = 0; r < rows; r++) {
+					*result.at(r, 0) = Reduction<T>::multiplyAccumulate(memory.at(r, 0), this->vector, this->depth);
+				}
+			} else {
+				//A strip of the result at a time, that stays in L1 while the columns are accumulated on it
+				const unsigned STRIP = 512;
+				T accumulator[STRIP];
+				for (unsigned strip = 0; strip < rows; strip += STRIP) {
+					unsigned length = std::min(STRIP, rows - strip);
+					std::fill(accumulator, accumulator + length, T());
+					for (unsigned k = 0; k < this->depth; k++) {
+						const T *column = memory.at(strip, k);
+						T value = this->vector[k];
+						for (unsigned r = 0; r < length; r++) {
+							accumulator[r] += column[r] * value;
+						}
+					}
+					for (unsigned r = 0; r < length; r++) {
+						*result.at(strip + r, 0) = accumulator[r];
+					}
+				}
+			}
+			return 2LL * rows * this->depth;
+		}
+};
+
+template<typename T>
+class StrassenProduct;
+
 /**
  * Implementation of <code>MatrixData</code> that exposes the multiplication of the two given matrices
  * @tparam T type of the data
@@ -64,6 +171,18 @@ class MultiplyMD : public OptimizableMD<T, OptimizedMultiplyMD<T>> {
 			return {&this->left, &this->right};
 		}
 
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint);
+		}
+
+		const MD1 &getLeft() const {
+			return this->left;
+		}
+
+		const MD2 &getRight() const {
+			return this->right;
+		}
+
 		MultiplyMD<T, MD1, MD2> copy() const {
 			return MultiplyMD<T, MD1, MD2>(this->left.copy(), this->right.copy());
 		}
@@ -79,16 +198,100 @@ class MultiplyMD : public OptimizableMD<T, OptimizedMultiplyMD<T>> {
 		}
 
 		/**
-		 * This method optimizes the multiplication tree, by doing first the multiplication that reduces the most
-		 * the number of dimensions
+		 * This method optimizes the multiplication tree, choosing the order of the multiplications that minimizes
+		 * the total cost
 		 */
 		std::unique_ptr<OptimizedMultiplyMD<T>> virtualCreateOptimizedMatrix() const override {
 			//Step 1: getting the chain of multiplications to perform
 			std::vector<const MatrixData<T> *> multiplicationChain;
 			addToMultiplicationChain(multiplicationChain);
-			//Step 3: execute the multiplications in an efficient order, until a single matrix is left
+			//Step 2: building the tree of multiplications
+			const MatrixData<T> *root;
+			if (multiplicationChain.size() <= MAX_OPTIMAL_CHAIN_LENGTH) {
+				root = this->createOptimalTree(multiplicationChain);
+			} else {
+				root = this->createGreedyTree(multiplicationChain);
+			}
+
+			//Step 3: the root is the multiplication result.
+			// It is a OptimizedMultiplyMD, since it comes from nodeReferences.
+			auto *optimized = static_cast<const OptimizedMultiplyMD<T> *>(root);
+			return std::make_unique<OptimizedMultiplyMD<T>>(*optimized);
+		}
+
+	private:
+
+		/**
+		 * Cost of reading the given matrix as an operand of a multiplication.
+		 * Every operand is materialized once, and the cost depends on how expensive it is to compute each cell
+		 * (e.g. a SumMDa has to read both its children).
+		 */
+		static double materializationCost(const MatrixData<T> *matrix) {
+			return (double) matrix->rows() * matrix->columns() * matrix->virtualGetAccessCost();
+		}
+
+		/**
+		 * Finds the optimal order of the multiplications with the classic O(n^3) dynamic programming algorithm.
+		 * The cost of a multiplication is given by its floating point operations, plus the cost of materializing its
+		 * operands: the leaves of the chain with their access cost, the intermediate results with a cost of one per cell.
+		 * @return the root of the tree, that has been created inside nodeReferences
+		 */
+		const MatrixData<T> *createOptimalTree(const std::vector<const MatrixData<T> *> &chain) const {
+			unsigned n = chain.size();
+			//Matrix i has size dimensions[i] x dimensions[i + 1]
+			std::vector<double> dimensions;
+			for (auto matrix : chain) {
+				dimensions.push_back(matrix->rows());
+			}
+			dimensions.push_back(chain[n - 1]->columns());
+
+			//cost[i * n + j] is the minimum cost to compute the product of the matrices from i to j (both included)
+			//split[i * n + j] is the index of the last matrix of the left operand in the optimal solution
+			std::vector<double> cost(n * n, 0);
+			std::vector<unsigned> split(n * n, 0);
+			for (unsigned length = 2; length <= n; length++) {
+				for (unsigned i = 0; i + length <= n; i++) {
+					unsigned j = i + length - 1;
+					cost[i * n + j] = -1;
+					for (unsigned s = i; s < j; s++) {
+						double leftCost = s == i ? materializationCost(chain[i]) : dimensions[i] * dimensions[s + 1];
+						double rightCost = s + 1 == j ? materializationCost(chain[j]) : dimensions[s + 1] * dimensions[j + 1];
+						double c = cost[i * n + s] + cost[(s + 1) * n + j] + leftCost + rightCost +
+								   2 * dimensions[i] * dimensions[s + 1] * dimensions[j + 1];
+						if (cost[i * n + j] < 0 || c < cost[i * n + j]) {
+							cost[i * n + j] = c;
+							split[i * n + j] = s;
+						}
+					}
+				}
+			}
+			return this->createTreeNode(chain, split, 0, n - 1);
+		}
+
+		/**
+		 * Creates inside nodeReferences the node that multiplies the matrices from i to j, following the given splits
+		 */
+		const MatrixData<T> *createTreeNode(const std::vector<const MatrixData<T> *> &chain, const std::vector<unsigned> &split,
+											unsigned i, unsigned j) const {
+			if (i == j) {
+				return chain[i];
+			}
+			unsigned s = split[i * chain.size() + j];
+			const MatrixData<T> *leftMatrix = this->createTreeNode(chain, split, i, s);
+			const MatrixData<T> *rightMatrix = this->createTreeNode(chain, split, s + 1, j);
+			nodeReferences.emplace_back(leftMatrix, rightMatrix);
+			return &nodeReferences.back();
+		}
+
+		/**
+		 * Builds the tree by doing first the multiplication that reduces the most the number of dimensions.
+		 * It is linear in the length of the chain for each step, so it's used for very long chains.
+		 * @return the root of the tree, that has been created inside nodeReferences
+		 */
+		const MatrixData<T> *createGreedyTree(std::vector<const MatrixData<T> *> multiplicationChain) const {
+			//Execute the multiplications in an efficient order, until a single matrix is left
 			while (multiplicationChain.size() > 1) {
-				//Step 3a: find the multiplication that reduces the multiplication the most
+				//Step a: find the multiplication that reduces the multiplication the most
 				unsigned bestIndex = 0;
 				for (unsigned i = 0; i < multiplicationChain.size() - 1; i++) {
 					if (multiplicationChain[i]->columns() > multiplicationChain[bestIndex]->columns()) {
@@ -98,18 +301,14 @@ class MultiplyMD : public OptimizableMD<T, OptimizedMultiplyMD<T>> {
 				const MatrixData<T> *leftMatrix = multiplicationChain[bestIndex];
 				const MatrixData<T> *rightMatrix = multiplicationChain[bestIndex + 1];
 
-				//Step 3b: replacing the two matrices in the chain with the computed product
+				//Step b: replacing the two matrices in the chain with the computed product
 				//Creating the multiplication inside nodeReferences
 				nodeReferences.emplace_back(leftMatrix, rightMatrix);
 				//Replacing the two matrices with the multiplication
 				multiplicationChain.erase(multiplicationChain.begin() + bestIndex + 1);
 				multiplicationChain[bestIndex] = &nodeReferences.back();
 			}
-
-			//Step 4: the last item in the chain is the multiplication result.
-			// It is a OptimizedMultiplyMD, since it comes from nodeReferences.
-			auto *optimized = static_cast<const OptimizedMultiplyMD<T> *>(multiplicationChain[0]);
-			return std::make_unique<OptimizedMultiplyMD<T>>(*optimized);
+			return multiplicationChain[0];
 		}
 };
 
@@ -117,17 +316,17 @@ class MultiplyMD : public OptimizableMD<T, OptimizedMultiplyMD<T>> {
  * This class is used only internally on MultiplyMD, to keep the optimal operation tree.
  */
 template<typename T>
-class OptimizedMultiplyMD : public OptimizableMD<T, ConcatenationMD<T, MultiSumMD<T, BaseMultiplyMD<T>>>> {
+class OptimizedMultiplyMD : public OptimizableMD<T, ConcatenationMD<T, BaseMultiplyMD<T>>> {
 	private:
 		const MatrixData<T> *left, *right;
 	public:
 		OptimizedMultiplyMD(const MatrixData<T> *left, const MatrixData<T> *right)
-				: OptimizableMD<T, ConcatenationMD<T, MultiSumMD<T, BaseMultiplyMD<T>>>>(left->rows(), right->columns()),
+				: OptimizableMD<T, ConcatenationMD<T, BaseMultiplyMD<T>>>(left->rows(), right->columns()),
 				  left(left), right(right) {
 		}
 
 		OptimizedMultiplyMD(const OptimizedMultiplyMD<T> &another) :
-				OptimizableMD<T, ConcatenationMD<T, MultiSumMD<T, BaseMultiplyMD<T>>>>(another),
+				OptimizableMD<T, ConcatenationMD<T, BaseMultiplyMD<T>>>(another),
 				left(another.left), right(another.right) {
 		}
 
@@ -138,53 +337,151 @@ class OptimizedMultiplyMD : public OptimizableMD<T, ConcatenationMD<T, MultiSumM
 			return {this->left, this->right};
 		}
 
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint);
+		}
+
 	protected:
+		/**
+		 * The same product of the same operands is computed once, even if it appears many times in an expression (or in
+		 * many expressions): the blocks of the result don't refer to this object once they have been computed
+		 */
+		bool virtualCanShareOptimized() const override {
+			return true;
+		}
+
 
-		std::unique_ptr<ConcatenationMD<T, MultiSumMD<T, BaseMultiplyMD<T>>>> virtualCreateOptimizedMatrix() const override {
-			auto optimalMultiplicationSize = (unsigned) sqrt(OPTIMAL_BLOCK_SIZE / (double) sizeof(T));
+		std::unique_ptr<ConcatenationMD<T, BaseMultiplyMD<T>>> virtualCreateOptimizedMatrix() const override {
+			if (this->left->virtualGetSparse() != NULL || this->right->virtualGetSparse() != NULL) {
+				return this->createSparseProduct();
+			}
+			if (this->right->columns() == 1 || this->left->rows() == 1) {
+				return this->createVectorProduct();
+			}
+			unsigned strassenLevels = Tuning::instance().strassenLevels<T>(this->left->rows(), this->left->columns(), this->right->columns());
+			if (strassenLevels > 0) {
+				auto product = std::make_shared<StrassenProduct<T>>(this->left, this->right, strassenLevels);
+				std::deque<BaseMultiplyMD<T>> resultingBlocks;
+				resultingBlocks.emplace_back(product, 0, product->rows);
+				return std::make_unique<ConcatenationMD<T, BaseMultiplyMD<T>>>(resultingBlocks, product->rows, product->columns);
+			}
+			//The sizes of the blocks depend on the caches of the host and on the shape of the operands
+			BlockSizes sizes = Tuning::instance().blockSizes<T>(this->left->rows(), this->left->columns(), this->right->columns());
 
-			//E.g. A Matrix 202x302 will be divided in 3x4 blocks, of size 68x76
-			unsigned numberOfGridRowsA = Utils::ceilDiv(this->left->rows(), optimalMultiplicationSize);//e.g. 3
-			unsigned rowsOfGridA = Utils::ceilDiv(this->left->rows(), numberOfGridRowsA);//e.g. 68
-			unsigned numberOfGridColsA = Utils::ceilDiv(this->left->columns(), optimalMultiplicationSize);//e.g. 4
-			unsigned colsOfGridA = Utils::ceilDiv(this->left->columns(), numberOfGridColsA);//e.g. 76
+			//E.g. A Matrix 202x302 will be divided in 3x4 blocks: the rows are 68, 68 and 66, the columns 76, 76, 76 and 74
+			unsigned numberOfGridRowsA = Utils::ceilDiv(this->left->rows(), sizes.rows);//e.g. 3
+			unsigned numberOfGridColsA = Utils::ceilDiv(this->left->columns(), sizes.depth);//e.g. 4
 			//Now that I've decided the blocks of A, I can comute the blocks of B.
-			//For example, if B is 302x404, it will be divided in 4x5 blocks of size 76x81
+			//For example, if B is 302x404, it will be divided in 4x5 blocks: the rows are the columns of A, the columns are 81 (80 the last)
 			unsigned numberOfGridRowsB = numberOfGridColsA;//4
-			unsigned rowsOfGridB = colsOfGridA;//76
-			unsigned numberOfGridColsB = Utils::ceilDiv(this->right->columns(), optimalMultiplicationSize);// e.g. 5
-			unsigned colsOfGridB = Utils::ceilDiv(this->right->columns(), numberOfGridColsB);//e.g. 81
-			//Now we divide the matrices in blocks
-			auto blocksOfA = this->divideInBlocks(this->left, numberOfGridRowsA, numberOfGridColsA);
-			auto blocksOfB = this->divideInBlocks(this->right, numberOfGridRowsB, numberOfGridColsB);
-
-			//Now the result C is a matrix 202x404, and has 3x5 blocks of size 68x81
-			std::deque<MultiSumMD<T, BaseMultiplyMD<T>>> resultingBlocks;
+			unsigned numberOfGridColsB = Utils::ceilDiv(this->right->columns(), sizes.columns);// e.g. 5
+			//Now we divide the matrices in blocks. The blocks at the edges are smaller, so no cell outside the matrices is computed
+			//Each block is packed once, directly from the operand, and shared by all the kernels that use it
+			auto blocksOfA = this->divideInBlocks(this->left, numberOfGridRowsA, numberOfGridColsA, PackedMatrixData<T>::LEFT);
+			auto blocksOfB = this->divideInBlocks(this->right, numberOfGridRowsB, numberOfGridColsB, PackedMatrixData<T>::RIGHT);
+
+			//Now the result C is a matrix 202x404, and has 3x5 blocks: 68x81, except the last row (66) and column (80) of blocks
+			//Each block is computed by a single kernel, that accumulates the products of a row of blocks of A and a column of blocks of B
+			std::deque<BaseMultiplyMD<T>> resultingBlocks;
 			for (unsigned r = 0; r < numberOfGridRowsA; r++) {
 				for (unsigned c = 0; c < numberOfGridColsB; c++) {
-					std::deque<BaseMultiplyMD<T>> toMultiply;
+					std::vector<std::shared_ptr<PackerMD<T>>> leftBlocks, rightBlocks;
 					for (unsigned k = 0; k < numberOfGridRowsB; k++) {
-						toMultiply.emplace_back(blocksOfA[r * numberOfGridColsA + k], blocksOfB[k * numberOfGridColsB + c]);
+						leftBlocks.push_back(blocksOfA[r * numberOfGridColsA + k]);
+						rightBlocks.push_back(blocksOfB[k * numberOfGridColsB + c]);
 					}
-					resultingBlocks.emplace_back(toMultiply);
+					resultingBlocks.emplace_back(leftBlocks, rightBlocks);
 				}
 			}
-			//optimized is LARGER or equal to this matrix, but that's not a problem
-			return std::make_unique<ConcatenationMD<T, MultiSumMD<T, BaseMultiplyMD<T>>>>(
-					resultingBlocks, numberOfGridRowsA * rowsOfGridA, numberOfGridColsB * colsOfGridB
-			);
+			return std::make_unique<ConcatenationMD<T, BaseMultiplyMD<T>>>(resultingBlocks, this->rows(), this->columns());
 		}
 
 	private:
 
-		std::vector<std::shared_ptr<ResizerMD<T, MaterializerMD<T>>>>
-		divideInBlocks(const MatrixData<T> *matrix, unsigned numberOfGridRows, unsigned numberOfGridCols) const {
+		/**
+		 * Multiplies a sparse operand with the other one, that is read as a dense matrix.
+		 * The result is divided in blocks of rows, each computed by the sparse kernels with a cost proportional to the
+		 * nonzero cells it uses.
+		 */
+		std::unique_ptr<ConcatenationMD<T, BaseMultiplyMD<T>>> createSparseProduct() const {
+			auto product = std::make_shared<SparseProduct<T>>();
+			product->sparse = this->left->virtualGetSparse();
+			product->sparseOnLeft = product->sparse != NULL;
+			if (!product->sparseOnLeft) {
+				product->sparse = this->right->virtualGetSparse();
+			}
+			product->rows = this->left->rows();
+			product->columns = this->right->columns();
+			//The dense operand is read in place when it has a strided layout, otherwise it is materialized once
+			const MatrixData<T> *dense = product->sparseOnLeft ? this->right : this->left;
+			product->dense = dense->virtualGetStrided();
+			if (!product->dense.isValid()) {
+				product->denseStorage = std::make_shared<VectorMatrixData<T>>(dense->virtualMaterialize(0, 0, dense->rows(), dense->columns()));
+				product->dense = product->denseStorage->strided();
+			}
+
+			unsigned workers = ThreadPool::instance().workerCount();
+			unsigned numberOfBlocks = std::max(1u, std::min(product->rows, 4 * workers));
+			unsigned rowsOfBlocks = Utils::ceilDiv(product->rows, numberOfBlocks);
+			numberOfBlocks = Utils::ceilDiv(product->rows, rowsOfBlocks);
+			std::deque<BaseMultiplyMD<T>> resultingBlocks;
+			for (unsigned b = 0; b < numberOfBlocks; b++) {
+				resultingBlocks.emplace_back(product, b * rowsOfBlocks, std::min(rowsOfBlocks, product->rows - b * rowsOfBlocks));
+			}
+			return std::make_unique<ConcatenationMD<T, BaseMultiplyMD<T>>>(resultingBlocks, product->rows, product->columns);
+		}
+
+		/**
+		 * Multiplies a matrix by a vector (or a covector by a matrix) with the kernels of <code>VectorProduct</code>,
+		 * instead of padding the vector to a whole block. The blocks of the result have about the same number of cells of
+		 * the matrix, so that they saturate the memory bandwidth without being too small for a task.
+		 */
+		std::unique_ptr<ConcatenationMD<T, BaseMultiplyMD<T>>> createVectorProduct() const {
+			auto product = std::make_shared<VectorProduct<T>>();
+			product->transposedResult = this->right->columns() != 1;
+			product->matrix = product->transposedResult ? this->right : this->left;
+			const MatrixData<T> *vector = product->transposedResult ? this->left : this->right;
+			product->depth = this->left->columns();
+			product->rows = product->transposedResult ? this->right->columns() : this->left->rows();
+			product->columns = 1;
+			product->memory = product->matrix->virtualGetStrided();
+			if (product->transposedResult) {
+				product->memory = product->memory.transposed();
+			}
+			//The vector is read once for each row of the matrix, so it must be contiguous
+			StridedData<T> vectorMemory = vector->virtualGetStrided();
+			if (product->transposedResult) {
+				vectorMemory = vectorMemory.transposed();
+			}
+			if (vectorMemory.isValid() && (vectorMemory.rowStride == 1 || product->depth == 1)) {
+				product->vector = vectorMemory.at(0, 0);
+			} else {
+				product->vectorStorage = std::make_shared<VectorMatrixData<T>>(vector->virtualMaterialize(0, 0, vector->rows(), vector->columns()));
+				product->vector = product->vectorStorage->strided().at(0, 0);
+			}
+
+			unsigned workers = ThreadPool::instance().workerCount();
+			std::size_t cells = (std::size_t) product->rows * product->depth;
+			unsigned numberOfBlocks = (unsigned) std::max<std::size_t>(1, std::min<std::size_t>(
+					std::min<std::size_t>(product->rows, 4 * workers), cells / PARALLEL_MATERIALIZE_MIN_CELLS));
+			unsigned rowsOfBlocks = Utils::ceilDiv(product->rows, numberOfBlocks);
+			numberOfBlocks = Utils::ceilDiv(product->rows, rowsOfBlocks);
+			std::deque<BaseMultiplyMD<T>> resultingBlocks;
+			for (unsigned b = 0; b < numberOfBlocks; b++) {
+				resultingBlocks.emplace_back(product, b * rowsOfBlocks, std::min(rowsOfBlocks, product->rows - b * rowsOfBlocks));
+			}
+			return std::make_unique<ConcatenationMD<T, BaseMultiplyMD<T>>>(resultingBlocks, this->rows(), this->columns());
+		}
+
+		std::vector<std::shared_ptr<PackerMD<T>>>
+		divideInBlocks(const MatrixData<T> *matrix, unsigned numberOfGridRows, unsigned numberOfGridCols,
+					   typename PackedMatrixData<T>::Side side) const {
 			//e.g. matrix is 202x302;
 			//numberOfGridRows = 3
 			// numberOfGridCols = 4
 			unsigned rowsOfGrid = Utils::ceilDiv(matrix->rows(), numberOfGridRows);//e.g. 68
 			unsigned colsOfGrid = Utils::ceilDiv(matrix->columns(), numberOfGridCols);//e.g. 76
-			std::vector<std::shared_ptr<ResizerMD<T, MaterializerMD<T>>>> ret;
+			std::vector<std::shared_ptr<PackerMD<T>>> ret;
 			for (unsigned r = 0; r < numberOfGridRows; r++) {
 				for (unsigned c = 0; c < numberOfGridCols; c++) {
 					unsigned blockRowStart = r * rowsOfGrid;//0, 68, 136
@@ -194,9 +491,8 @@ class OptimizedMultiplyMD : public OptimizableMD<T, ConcatenationMD<T, MultiSumM
 					unsigned int blockRows = blockRowEnd - blockRowStart;
 					unsigned int blockCols = blockColEnd - blockColStart;
 
-					MaterializerMD<T> block(matrix, blockRowStart, blockColStart, blockRows, blockCols);
-					//I wrap the matrix in a ResizerMD to make sure every block is of the same size
-					ret.push_back(std::make_shared<ResizerMD<T, MaterializerMD<T>>>(block, rowsOfGrid, colsOfGrid));
+					//The blocks at the edges are smaller: only the cells of the matrix are packed and multiplied
+					ret.push_back(std::make_shared<PackerMD<T>>(matrix, blockRowStart, blockColStart, blockRows, blockCols, side));
 				}
 			}
 			return ret;
@@ -204,13 +500,32 @@ class OptimizedMultiplyMD : public OptimizableMD<T, ConcatenationMD<T, MultiSumM
 
 };
 
+/**
+ * Computes a single block of the result, as the sum of the products of a row of blocks of the left matrix and a column
+ * of blocks of the right matrix.
+ * The blocks are packed by <code>PackerMD</code>, and every pair is multiplied by the register-blocked kernel of <code>GemmKernel</code>.
+ * For a <code>RowBlockProduct</code> (e.g. when an operand is sparse), the block is instead a group of whole rows of the
+ * result, computed by the kernels of the product.
+ */
 template<typename T>
 class BaseMultiplyMD : public OptimizableMD<T, VectorMatrixData<T>> {
 	private:
-		mutable std::shared_ptr<ResizerMD<T, MaterializerMD<T>>> left, right;
+		mutable std::vector<std::shared_ptr<PackerMD<T>>> left, right;
+		mutable std::shared_ptr<const RowBlockProduct<T>> product;
+		unsigned rowOffset = 0;
 	public:
-		BaseMultiplyMD(std::shared_ptr<ResizerMD<T, MaterializerMD<T>>> left, std::shared_ptr<ResizerMD<T, MaterializerMD<T>>> right)
-				: OptimizableMD<T, VectorMatrixData<T>>(left->rows(), right->columns()), left(left), right(right) {
+		BaseMultiplyMD(std::vector<std::shared_ptr<PackerMD<T>>> left, std::vector<std::shared_ptr<PackerMD<T>>> right)
+				: OptimizableMD<T, VectorMatrixData<T>>(left[0]->rows(), right[0]->columns()), left(left), right(right) {
+		}
+
+		/**
+		 * Creates the block of the given rows of a product with kernels of its own (of the given columns, if the product
+		 * computes the transposed result)
+		 */
+		BaseMultiplyMD(std::shared_ptr<const RowBlockProduct<T>> product, unsigned rowOffset, unsigned rows)
+				: OptimizableMD<T, VectorMatrixData<T>>(product->transposedResult ? product->columns : rows,
+														product->transposedResult ? rows : product->columns),
+				  product(product), rowOffset(rowOffset) {
 		}
 
 		//I cannot return left or right, since I could leak an object that will be deleted in the future
@@ -223,27 +538,173 @@ class BaseMultiplyMD : public OptimizableMD<T, VectorMatrixData<T>> {
 
 		std::unique_ptr<VectorMatrixData<T>> virtualCreateOptimizedMatrix() const override {
 			//Since OptimizableMD doesn't call optimize on children automatically, I do it here
-			this->left->optimize();
-			this->right->optimize();
-
-			//Keeping the references to left and right, to save some time when calling get()
-			ResizerMD<T, MaterializerMD<T>> *ll = this->left.get();
-			ResizerMD<T, MaterializerMD<T>> *rr = this->right.get();
-			std::unique_ptr<VectorMatrixData<T>> ret = std::make_unique<VectorMatrixData<T>>(ll->rows(), rr->columns());
-			for (unsigned int r = 0; r < ret->rows(); r++) {
-				for (unsigned int c = 0; c < ret->columns(); c++) {
-					T sum = 0;
-					for (unsigned j = 0; j < ll->columns(); j++) {
-						sum += ll->get(r, j) * rr->get(j, c);
-					}
-					ret->set(r, c, sum);
-				}
+			for (unsigned k = 0; k < this->left.size(); k++) {
+				this->left[k]->optimize();
+				this->right[k]->optimize();
+			}
+
+			if (this->product) {
+				return this->multiplyRows();
+			}
+
+			unsigned rows = this->rows(), columns = this->columns();
+			//The kernel accumulates on the result, so it starts from zero
+			auto result = std::make_shared<typename VectorMatrixData<T>::Storage>((std::size_t) rows * columns, T());
+			for (unsigned k = 0; k < this->left.size(); k++) {
+				unsigned depth = this->left[k]->columns();
+				GemmKernel<T>::multiply(rows, columns, depth, this->left[k]->panels(), this->right[k]->panels(), result->data(), columns);
+				Profiler::addFlops(2LL * rows * columns * depth);
 			}
 
 			//Freeing memory
-			this->left.reset();
-			this->right.reset();
-			return ret;
+			this->left.clear();
+			this->right.clear();
+			return std::make_unique<VectorMatrixData<T>>(rows, columns, result);
+		}
+
+	private:
+		std::unique_ptr<VectorMatrixData<T>> multiplyRows() const {
+			auto result = std::make_unique<VectorMatrixData<T>>(this->rows(), this->columns());
+			bool transposed = this->product->transposedResult;
+			unsigned rows = transposed ? this->columns() : this->rows();
+			StridedData<T> destination = transposed ? result->strided().transposed() : result->strided();
+			Profiler::addFlops(this->product->multiplyRows(this->rowOffset, rows, destination));
+			this->product.reset();
+			return result;
+		}
+};
+
+/**
+ * A large, roughly square multiplication computed with the Strassen-Winograd algorithm: the operands are split in four
+ * quadrants, whose product needs 7 multiplications (and 15 additions) instead of 8. Each level of the recursion saves an
+ * eighth of the multiplications; the smallest products are computed by <code>OptimizedMultiplyMD</code>, with the
+ * classic blocked algorithm.
+ *
+ * The operands are materialized once, padded with zeros to sizes that can be halved at every level.
+ * It's used according to <code>Tuning::strassenLevels()</code>.
+ */
+template<typename T>
+class StrassenProduct : public RowBlockProduct<T> {
+	private:
+		const MatrixData<T> *left, *right;
+		unsigned levels;
+
+	public:
+		StrassenProduct(const MatrixData<T> *left, const MatrixData<T> *right, unsigned levels) : left(left), right(right), levels(levels) {
+			this->rows = left->rows();
+			this->columns = right->columns();
+		}
+
+		long long multiplyRows(unsigned rowOffset, unsigned rows, const StridedData<T> &result) const override {
+			if (rowOffset != 0 || rows != this->rows) {
+				Utils::error("The Strassen product is computed as a single block");
+			}
+			unsigned multiple = 1u << this->levels;
+			unsigned m = Utils::ceilDiv(this->rows, multiple) * multiple;
+			unsigned k = Utils::ceilDiv(this->left->columns(), multiple) * multiple;
+			unsigned n = Utils::ceilDiv(this->columns, multiple) * multiple;
+			std::vector<VectorMatrixData<T>> buffers;
+			StridedData<T> a = operand(this->left, m, k, buffers);
+			StridedData<T> b = operand(this->right, k, n, buffers);
+			if (m == this->rows && n == this->columns && result.hasContiguousRows()) {
+				multiply(a, b, result, m, k, n, this->levels);
+			} else {
+				VectorMatrixData<T> c = VectorMatrixData<T>::uninitialized(m, n);
+				multiply(a, b, c.strided(), m, k, n, this->levels);
+				c.strided().copyTo(this->rows, this->columns, result);
+			}
+			//The floating point operations are counted by the classic products
+			return 0;
+		}
+
+	private:
+		/**
+		 * @return the memory of the given matrix, padded with zeros to rows x columns. The matrix is read in place when it
+		 * has the right size and contiguous rows, otherwise it's materialized in a new buffer.
+		 */
+		static StridedData<T> operand(const MatrixData<T> *matrix, unsigned rows, unsigned columns,
+									  std::vector<VectorMatrixData<T>> &buffers) {
+			StridedData<T> memory = matrix->virtualGetStrided();
+			if (memory.isValid() && memory.hasContiguousRows() && matrix->rows() == rows && matrix->columns() == columns) {
+				return memory;
+			}
+			bool padded = matrix->rows() != rows || matrix->columns() != columns;
+			buffers.push_back(padded ? VectorMatrixData<T>(rows, columns) : VectorMatrixData<T>::uninitialized(rows, columns));
+			matrix->virtualMaterializeInto(0, 0, matrix->rows(), matrix->columns(), buffers.back().strided());
+			return buffers.back().strided();
+		}
+
+		/**
+		 * c = a * b, where a is m x k and b is k x n. The sizes are multiples of 2^levels, and the rows are contiguous.
+		 */
+		static void multiply(const StridedData<T> &a, const StridedData<T> &b, const StridedData<T> &c, unsigned m, unsigned k,
+							 unsigned n, unsigned levels) {
+			if (levels == 0) {
+				StridedMD<T> leftLeaf(a, m, k), rightLeaf(b, k, n);
+				OptimizedMultiplyMD<T> product(&leftLeaf, &rightLeaf);
+				product.virtualMaterializeInto(0, 0, m, n, c);
+				return;
+			}
+			unsigned hm = m / 2, hk = k / 2, hn = n / 2;
+			StridedData<T> a11 = a, a12 = a.offset(0, hk), a21 = a.offset(hm, 0), a22 = a.offset(hm, hk);
+			StridedData<T> b11 = b, b12 = b.offset(0, hn), b21 = b.offset(hk, 0), b22 = b.offset(hk, hn);
+			StridedData<T> c11 = c, c12 = c.offset(0, hn), c21 = c.offset(hm, 0), c22 = c.offset(hm, hn);
+
+			//Sums of the quadrants of the operands
+			std::vector<VectorMatrixData<T>> s, t, p;
+			for (unsigned i = 0; i < 4; i++) {
+				s.push_back(VectorMatrixData<T>::uninitialized(hm, hk));
+				t.push_back(VectorMatrixData<T>::uninitialized(hk, hn));
+			}
+			for (unsigned i = 0; i < 7; i++) {
+				p.push_back(VectorMatrixData<T>::uninitialized(hm, hn));
+			}
+			combine(a21, a22, s[0].strided(), hm, hk, false);
+			combine(s[0].strided(), a11, s[1].strided(), hm, hk, true);
+			combine(a11, a21, s[2].strided(), hm, hk, true);
+			combine(a12, s[1].strided(), s[3].strided(), hm, hk, true);
+			combine(b12, b11, t[0].strided(), hk, hn, true);
+			combine(b22, t[0].strided(), t[1].strided(), hk, hn, true);
+			combine(b22, b12, t[2].strided(), hk, hn, true);
+			combine(t[1].strided(), b21, t[3].strided(), hk, hn, true);
+
+			//The 7 products
+			multiply(a11, b11, p[0].strided(), hm, hk, hn, levels - 1);
+			multiply(a12, b21, p[1].strided(), hm, hk, hn, levels - 1);
+			multiply(s[3].strided(), b22, p[2].strided(), hm, hk, hn, levels - 1);
+			multiply(a22, t[3].strided(), p[3].strided(), hm, hk, hn, levels - 1);
+			multiply(s[0].strided(), t[0].strided(), p[4].strided(), hm, hk, hn, levels - 1);
+			multiply(s[1].strided(), t[1].strided(), p[5].strided(), hm, hk, hn, levels - 1);
+			multiply(s[2].strided(), t[2].strided(), p[6].strided(), hm, hk, hn, levels - 1);
+
+			//Combining them in the quadrants of the result
+			combine(p[0].strided(), p[1].strided(), c11, hm, hn, false);
+			combine(p[0].strided(), p[5].strided(), p[0].strided(), hm, hn, false);//U2
+			combine(p[0].strided(), p[6].strided(), p[6].strided(), hm, hn, false);//U3
+			combine(p[0].strided(), p[4].strided(), p[0].strided(), hm, hn, false);//U4
+			combine(p[0].strided(), p[2].strided(), c12, hm, hn, false);
+			combine(p[6].strided(), p[3].strided(), c21, hm, hn, true);
+			combine(p[6].strided(), p[4].strided(), c22, hm, hn, false);
+		}
+
+		/**
+		 * destination = x + y, or x - y. The destination can be one of the operands.
+		 */
+		static void combine(const StridedData<T> &x, const StridedData<T> &y, const StridedData<T> &destination,
+							unsigned rows, unsigned columns, bool subtract) {
+			for (unsigned r = 0; r < rows; r++) {
+				const T *first = x.at(r, 0), *second = y.at(r, 0);
+				T *output = destination.at(r, 0);
+				if (subtract) {
+					for (unsigned col = 0; col < columns; col++) {
+						output[col] = first[col] - second[col];
+					}
+				} else {
+					for (unsigned col = 0; col < columns; col++) {
+						output[col] = first[col] + second[col];
+					}
+				}
+			}
 		}
 };
 
@@ -5,18 +5,87 @@
 #ifndef MATRIX_OPIMIZABLEMD_H
 #define MATRIX_OPIMIZABLEMD_H
 
+#include <atomic>
 #include <deque>
 #include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "MatrixData.h"
+#include "ThreadPool.h"
+
+/**
+ * The optimizations started by the matrices that can share them, by fingerprint: a matrix with the fingerprint of a
+ * running (or finished) optimization reuses its result instead of computing it again, e.g. the two products of
+ * <code>a * b + a * b</code>, or the same product in two expressions.
+ * The entries are weak references: a result is freed when the last matrix that uses it is destroyed.
+ * @tparam Task type of the shared tasks
+ */
+template<class Task>
+class OptimizationCache {
+	private:
+		std::mutex mutex;
+		std::map<Fingerprint, std::weak_ptr<Task>> entries;
+		//The expired entries are removed when the cache grows to this size
+		std::size_t pruneSize = 64;
+
+	public:
+		static OptimizationCache<Task> &instance() {
+			static OptimizationCache<Task> *cache = new OptimizationCache<Task>();
+			return *cache;
+		}
+
+		/**
+		 * @return the task with the given fingerprint, if it's still used, or a new one created by submit()
+		 */
+		template<class F>
+		std::shared_ptr<Task> share(const Fingerprint &fingerprint, F submit) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			std::weak_ptr<Task> &entry = this->entries[fingerprint];
+			std::shared_ptr<Task> task = entry.lock();
+			if (!task) {
+				task = submit();
+				entry = task;
+				if (this->entries.size() >= this->pruneSize) {
+					this->prune();
+				}
+			}
+			return task;
+		}
+
+	private:
+		void prune() {
+			for (auto it = this->entries.begin(); it != this->entries.end();) {
+				it = it->second.expired() ? this->entries.erase(it) : std::next(it);
+			}
+			this->pruneSize = std::max<std::size_t>(64, 2 * this->entries.size());
+		}
+};
 
+/**
+ * Base class of the matrices that are evaluated lazily, creating an optimized matrix (e.g. the result of a product) in a
+ * task of the <code>ThreadPool</code>.
+ *
+ * The optimization is started once, by the first thread that calls optimize(): the others see its task through the
+ * state, which goes from NOT_STARTED to SUBMITTING (only one thread wins the compare-and-swap) and then to SUBMITTED.
+ * The pointer to the optimized matrix is published with a release store once the task has finished, so after the first
+ * access reading a cell costs a single acquire load, without locks.
+ *
+ * The implementations whose optimized matrix doesn't refer to them once it has been computed can share it with the
+ * matrices with the same fingerprint (see <code>OptimizationCache</code>).
+ */
 template<typename T, class O>
 class OptimizableMD : public MatrixData<T> {
-	protected:
-		mutable std::mutex optimizeMutex; //Mutex for the method optimize()
 	private:
-		mutable std::shared_future<std::unique_ptr<O>> optimized;
+		static const int NOT_STARTED = 0, SUBMITTING = 1, SUBMITTED = 2;
+
+		mutable std::atomic<int> state{NOT_STARTED};
+		//Written once by the thread that submits the task, before the state becomes SUBMITTED. It can be shared with the
+		//matrices with the same fingerprint.
+		mutable std::shared_ptr<const PoolTask<std::unique_ptr<O>>> optimized;
 		//I'm saving the pointer to optimized matrix in order to skip accessing it through a future and a unique_ptr
-		mutable O *optimizedPointer = NULL;
+		mutable std::atomic<O *> optimizedPointer{NULL};
 
 	public:
 
@@ -27,7 +96,7 @@ class OptimizableMD : public MatrixData<T> {
 		OptimizableMD(const OptimizableMD<T, O> &another) :
 				MatrixData<T>(another.rows(), another.columns()) {
 			//The cached data is not passed around, since it will be too difficult to copy
-			if (another.optimizedPointer != NULL) {
+			if (another.optimizedPointer.load(std::memory_order_acquire) != NULL) {
 				std::cout << "Warning: cached data is lost!\n";
 			}
 		}
@@ -38,21 +107,44 @@ class OptimizableMD : public MatrixData<T> {
 		}
 
 		virtual ~OptimizableMD() {
-			if (this->optimized.valid()) {
-				this->optimized.wait();
+			PoolTask<std::unique_ptr<O>> task = this->submittedTask();
+			if (task.valid()) {
+				ThreadPool::instance().wait(task);
 			}
 		}
 
-		MATERIALIZE_IMPL
+		void virtualMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+									const StridedData<T> &destination) const override {
+			if (rowOffset + rows > this->rows() || colOffset + columns > this->columns()) {
+				Utils::error("Illegal bounds");
+			}
+			Profiler::Scope scope(this, Profiler::current(), true);
+			this->getOptimized()->virtualMaterializeInto(rowOffset, colOffset, rows, columns, destination);
+		}
+
+		VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const override {
+			VectorMatrixData<T> ret = VectorMatrixData<T>::uninitialized(rows, columns);
+			this->virtualMaterializeInto(rowOffset, colOffset, rows, columns, ret.strided());
+			return ret;
+		}
+
+		StridedData<T> virtualGetStrided() const override {
+			return this->strided();
+		}
+
+		/**
+		 * Once the optimized matrix is available, this is a single acquire load followed by the (inlined) read of the cell
+		 */
+		T get(unsigned row, unsigned col) const {
+			return this->getOptimized()->get(row, col);
+		}
 
 		void virtualWaitOptimized() const override {
 			MatrixData<T>::virtualWaitOptimized();
-			auto future = this->optimized;
-			if (future.valid()) {
-				future.wait();
-			}
-			if (this->optimizedPointer != NULL) {
-				this->optimizedPointer->virtualWaitOptimized();
+			PoolTask<std::unique_ptr<O>> task = this->submittedTask();
+			if (task.valid()) {
+				ThreadPool::instance().wait(task);
+				task.get()->virtualWaitOptimized();
 			}
 		}
 
@@ -60,29 +152,100 @@ class OptimizableMD : public MatrixData<T> {
 			this->optimize();
 		}
 
+		/**
+		 * Once optimized, the cells are read from the cached result
+		 */
+		double virtualGetAccessCost() const override {
+			return 1;
+		}
+
+		/**
+		 * Starts the optimization in the ThreadPool, if it hasn't been started yet
+		 */
 		void optimize() const {
-			std::unique_lock<std::mutex> lock(this->optimizeMutex);
-			if (!this->optimizeHasBeenCalled) {
-				this->optimized = std::async(std::launch::async, [=] {
-					auto ptr = this->virtualCreateOptimizedMatrix();
-					ptr->virtualOptimize();
-					return ptr;
-				}).share();
-				this->optimizeHasBeenCalled = true;
+			if (this->state.load(std::memory_order_acquire) == SUBMITTED) {
+				return;
+			}
+			int expected = NOT_STARTED;
+			if (this->state.compare_exchange_strong(expected, SUBMITTING, std::memory_order_acq_rel)) {
+				//The node that requested the optimization is the parent of this one in the profile
+				unsigned parent = Profiler::current();
+				auto submit = [this, parent] {
+					return std::make_shared<const PoolTask<std::unique_ptr<O>>>(ThreadPool::instance().submit([=] {
+						Profiler::Scope scope(this, parent, false);
+						auto ptr = this->virtualCreateOptimizedMatrix();
+						ptr->virtualOptimize();
+						return ptr;
+					}));
+				};
+				Fingerprint fingerprint;
+				if (this->virtualCanShareOptimized() && this->virtualFingerprint(fingerprint)) {
+					this->optimized = OptimizationCache<const PoolTask<std::unique_ptr<O>>>::instance().share(fingerprint, submit);
+				} else {
+					this->optimized = submit();
+				}
+				this->state.store(SUBMITTED, std::memory_order_release);
+				this->optimizeHasBeenCalled.store(true, std::memory_order_release);
+			} else {
+				//Another thread is submitting the task: it's a matter of a few instructions
+				while (this->state.load(std::memory_order_acquire) != SUBMITTED) {
+					std::this_thread::yield();
+				}
 			}
 		}
 
-	private:
-		T doGet(unsigned row, unsigned col) const {
-			if (this->optimizedPointer == NULL) {
-				//I'm saving the pointer to optimized matrix in order to skip accessing it through a future and a unique_ptr
-				this->optimizedPointer = optimized.get().get();
+		/**
+		 * @return the memory of the optimized matrix, if it has a strided layout. It waits for the optimization to finish.
+		 */
+		StridedData<T> strided() const {
+			return this->getOptimized()->strided();
+		}
+
+	protected:
+		/**
+		 * @return the optimized matrix. It starts the optimization if needed, and waits for it to finish.
+		 */
+		O *getOptimized() const {
+			O *pointer = this->optimizedPointer.load(std::memory_order_acquire);
+			if (pointer == NULL) {
+				pointer = this->waitOptimized();
 			}
-			return this->optimizedPointer->get(row, col);
+			return pointer;
 		}
 
+	private:
+		/**
+		 * The slow path of getOptimized(): if the task is still queued, this thread executes it
+		 */
+		O *waitOptimized() const {
+			this->optimize();
+			//Every thread waits on its own copy of the task
+			PoolTask<std::unique_ptr<O>> task = *this->optimized;
+			ThreadPool::instance().wait(task);
+			O *pointer = task.get().get();
+			this->optimizedPointer.store(pointer, std::memory_order_release);
+			return pointer;
+		}
+
+		/**
+		 * @return the task of the optimization, or an invalid task if it hasn't been submitted
+		 */
+		PoolTask<std::unique_ptr<O>> submittedTask() const {
+			if (this->state.load(std::memory_order_acquire) != SUBMITTED) {
+				return PoolTask<std::unique_ptr<O>>();
+			}
+			return *this->optimized;
+		}
 
 	protected:
+		/**
+		 * @return true if the optimized matrix can be shared with the matrices with the same fingerprint: it must not
+		 * refer to this object once it has been computed, and this object must not be destroyed before that (e.g.
+		 * <code>MultiplyMD</code> waits for its whole tree)
+		 */
+		virtual bool virtualCanShareOptimized() const {
+			return false;
+		}
 
 		/**
 		 * This method optimizes the multiplication if the multiplication chain involves more than three matrix.
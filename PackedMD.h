@@ -0,0 +1,138 @@
+#ifndef MATRIX_PACKEDMD_H
+#define MATRIX_PACKEDMD_H
+
+#include "MatrixData.h"
+#include "OptimizableMD.h"
+#include "GemmKernel.h"
+
+/**
+ * Block of an operand of the multiplication, stored in the panel layout read by <code>GemmKernel</code>.
+ *
+ * A left operand is stored in panels of MR rows, column by column; a right operand in panels of NR columns, row by row.
+ * The cells that are not written by the packer (e.g. the padding of the last panel) are zero.
+ * @tparam T type of the data
+ */
+template<typename T>
+class PackedMatrixData : public MatrixData<T> {
+	public:
+		enum Side {
+			LEFT, RIGHT
+		};
+
+	private:
+		typename GemmKernel<T>::Buffer buffer;
+		Side side;
+
+	public:
+		PackedMatrixData(unsigned rows, unsigned columns, Side side) :
+				MatrixData<T>(rows, columns),
+				buffer(side == LEFT ? GemmKernel<T>::packedLeftSize(rows, columns) : GemmKernel<T>::packedRightSize(rows, columns), T()),
+				side(side) {
+		}
+
+		MATERIALIZE_IMPL
+
+		/**
+		 * @return the packed panels, to be passed to <code>GemmKernel::multiply()</code>
+		 */
+		const T *panels() const {
+			return this->buffer.data();
+		}
+
+		/**
+		 * @return the memory of the panel that contains the given cell, starting at that cell.
+		 * Regions that are written through it must not cross the panel.
+		 */
+		StridedData<T> panelAt(unsigned row, unsigned col) {
+			if (this->side == LEFT) {
+				return StridedData<T>(this->buffer.data() + this->indexOf(row, col), 1, GemmKernel<T>::MR);
+			}
+			return StridedData<T>(this->buffer.data() + this->indexOf(row, col), GemmKernel<T>::NR, 1);
+		}
+
+		StridedData<T> strided() const {
+			//The panels don't form a single strided matrix
+			return StridedData<T>();
+		}
+
+	private:
+		std::size_t indexOf(unsigned row, unsigned col) const {
+			if (this->side == LEFT) {
+				const unsigned MR = GemmKernel<T>::MR;
+				return (std::size_t) (row - row % MR) * this->columns() + col * MR + row % MR;
+			}
+			const unsigned NR = GemmKernel<T>::NR;
+			return (std::size_t) (col - col % NR) * this->rows() + row * NR + col % NR;
+		}
+
+		T doGet(unsigned row, unsigned col) const {
+			return this->buffer[this->indexOf(row, col)];
+		}
+};
+
+/**
+ * Packs a region of a matrix for <code>GemmKernel</code>.
+ *
+ * The region is evaluated directly into the panels with <code>virtualMaterializeInto()</code>: if the wrapped matrix is an
+ * expression (e.g. a sum, or a cast), its cells are computed while packing, and no temporary row-major block is created.
+ * The regions at the edges of the matrix can have any size: only the last panel is padded (see <code>GemmKernel</code>).
+ *
+ * The same packed block is shared by all the blocks of the result that use it, so every operand block is evaluated once.
+ * @tparam T type of the data
+ */
+template<typename T>
+class PackerMD : public OptimizableMD<T, PackedMatrixData<T>> {
+	private:
+		const MatrixData<T> *wrapped;
+		unsigned rowOffset, colOffset;
+		typename PackedMatrixData<T>::Side side;
+
+	public:
+		/**
+		 * @param wrapped the matrix that contains the region
+		 * @param rowOffset, colOffset, rows, columns the region of the wrapped matrix
+		 */
+		PackerMD(const MatrixData<T> *wrapped, unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+				 typename PackedMatrixData<T>::Side side) :
+				OptimizableMD<T, PackedMatrixData<T>>(rows, columns), wrapped(wrapped), rowOffset(rowOffset), colOffset(colOffset),
+				side(side) {
+			if (rowOffset + rows > wrapped->rows() || colOffset + columns > wrapped->columns()) {
+				Utils::error("Illegal bounds");
+			}
+		}
+
+		/**
+		 * @return the packed panels. It waits for the packing to finish.
+		 */
+		const T *panels() const {
+			return this->getOptimized()->panels();
+		}
+
+		std::vector<const MatrixData<T> *> virtualGetChildren() const override {
+			return {this->wrapped};
+		}
+
+	protected:
+		std::unique_ptr<PackedMatrixData<T>> virtualCreateOptimizedMatrix() const override {
+			auto packed = std::make_unique<PackedMatrixData<T>>(this->rows(), this->columns(), this->side);
+			//Every panel is a strided matrix, so it's filled with a single call
+			if (this->side == PackedMatrixData<T>::LEFT) {
+				const unsigned MR = GemmKernel<T>::MR;
+				for (unsigned panel = 0; panel < this->rows(); panel += MR) {
+					unsigned panelRows = std::min(MR, this->rows() - panel);
+					this->wrapped->virtualMaterializeInto(this->rowOffset + panel, this->colOffset, panelRows, this->columns(),
+														  packed->panelAt(panel, 0));
+				}
+			} else {
+				const unsigned NR = GemmKernel<T>::NR;
+				for (unsigned panel = 0; panel < this->columns(); panel += NR) {
+					unsigned panelCols = std::min(NR, this->columns() - panel);
+					this->wrapped->virtualMaterializeInto(this->rowOffset, this->colOffset + panel, this->rows(), panelCols,
+														  packed->panelAt(0, panel));
+				}
+			}
+			return packed;
+		}
+};
+
+#endif //MATRIX_PACKEDMD_H
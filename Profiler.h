@@ -0,0 +1,299 @@
+#ifndef MATRIX_PROFILER_H
+#define MATRIX_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <utility>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+/**
+ * Opt-in profiler of the evaluation of the expression trees.
+ *
+ * While it's enabled (between <code>start()</code> and <code>stop()</code>), every node of the tree records:
+ * - when its optimization started and ended, and on which thread it ran;
+ * - how long it was blocked waiting for other tasks;
+ * - how many bytes it materialized, and how many floating point operations it performed.
+ *
+ * The optimization of an <code>OptimizableMD</code> is a record of its own, whose parent is the node that requested it.
+ * The materializations of the other nodes (e.g. a <code>SumMDa</code> evaluated while packing a block) are summed in a
+ * single record for each node and parent.
+ *
+ * The records can be exported as an indented tree, as a DOT graph, or as a Chrome trace (chrome://tracing, Perfetto).
+ * When the profiler is disabled, the cost is a single atomic load for each event.
+ */
+class Profiler {
+	public:
+		static const unsigned NO_RECORD = (unsigned) -1;
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Record {
+			unsigned parent;
+			std::string name;
+			const void *node;
+			unsigned thread;
+			Clock::time_point start, end;
+			bool finished = false;
+			long long duration = 0, blocked = 0, bytes = 0, flops = 0;
+			unsigned calls = 0;
+		};
+
+		std::atomic<bool> enabled{false};
+		std::mutex mutex;
+		std::deque<Record> records;
+		std::map<std::pair<unsigned, const void *>, unsigned> aggregated;
+		std::map<std::string, unsigned> threads;
+		Clock::time_point origin;
+
+		Profiler() = default;
+
+	public:
+		/**
+		 * Scope of a node: the events that happen on this thread while the scope is alive are attributed to the node
+		 */
+		class Scope {
+			private:
+				unsigned record = NO_RECORD, previous = NO_RECORD;
+				Clock::time_point begin;
+
+			public:
+				/**
+				 * @param node the node, exposing virtualGetName()
+				 * @param parent the record of the node that started this work
+				 * @param aggregate true to sum this scope with the previous ones of the same node and parent
+				 */
+				template<class N>
+				Scope(const N *node, unsigned parent, bool aggregate) {
+					if (Profiler::isEnabled()) {
+						this->begin = Clock::now();
+						this->record = instance().open(node, node->virtualGetName(), parent, aggregate, this->begin);
+						this->previous = currentRecord();
+						currentRecord() = this->record;
+					}
+				}
+
+				Scope(const Scope &) = delete;
+
+				~Scope() {
+					if (this->record != NO_RECORD) {
+						currentRecord() = this->previous;
+						instance().close(this->record, this->begin, Clock::now());
+					}
+				}
+		};
+
+		/**
+		 * Clears the previous records, and starts recording
+		 */
+		static void start() {
+			Profiler &profiler = instance();
+			std::unique_lock<std::mutex> lock(profiler.mutex);
+			profiler.records.clear();
+			profiler.aggregated.clear();
+			profiler.threads.clear();
+			profiler.origin = Clock::now();
+			profiler.enabled = true;
+		}
+
+		static void stop() {
+			instance().enabled = false;
+		}
+
+		static bool isEnabled() {
+			return instance().enabled.load(std::memory_order_relaxed);
+		}
+
+		/**
+		 * @return the record of the node that is running on this thread, or NO_RECORD
+		 */
+		static unsigned current() {
+			return isEnabled() ? currentRecord() : NO_RECORD;
+		}
+
+		static void addBlockedTime(std::chrono::nanoseconds time) {
+			add(&Record::blocked, time.count());
+		}
+
+		static void addBytes(long long bytes) {
+			add(&Record::bytes, bytes);
+		}
+
+		static void addFlops(long long flops) {
+			add(&Record::flops, flops);
+		}
+
+		/**
+		 * @return a name for the given type, without the template arguments
+		 */
+		static std::string nameOf(const std::type_info &type) {
+			std::string name = type.name();
+#if defined(__GNUG__)
+			int status;
+			char *demangled = abi::__cxa_demangle(type.name(), NULL, NULL, &status);
+			if (status == 0) {
+				name = demangled;
+			}
+			std::free(demangled);
+#endif
+			return name.substr(0, name.find('<'));
+		}
+
+		/**
+		 * @return the records as an indented tree, one node per line
+		 */
+		static std::string toText() {
+			Profiler &profiler = instance();
+			std::unique_lock<std::mutex> lock(profiler.mutex);
+			std::ostringstream out;
+			for (unsigned i = 0; i < profiler.records.size(); i++) {
+				if (profiler.records[i].parent == NO_RECORD) {
+					profiler.printText(out, i, 0);
+				}
+			}
+			return out.str();
+		}
+
+		/**
+		 * @return the records as a graph in the DOT language
+		 */
+		static std::string toDot() {
+			Profiler &profiler = instance();
+			std::unique_lock<std::mutex> lock(profiler.mutex);
+			std::ostringstream out;
+			out << "digraph profile {\n\tnode [shape=box];\n";
+			for (unsigned i = 0; i < profiler.records.size(); i++) {
+				const Record &record = profiler.records[i];
+				out << "\tn" << i << " [label=\"" << record.name << "\\n" << milliseconds(record.duration) << " ms on thread "
+					<< record.thread << "\\nblocked " << milliseconds(record.blocked) << " ms\\n" << record.bytes << " bytes, "
+					<< record.flops << " flops\"];\n";
+				if (record.parent != NO_RECORD) {
+					out << "\tn" << record.parent << " -> n" << i << ";\n";
+				}
+			}
+			out << "}\n";
+			return out.str();
+		}
+
+		/**
+		 * @return the records in the Trace Event Format, to be loaded in chrome://tracing or Perfetto
+		 */
+		static std::string toChromeTrace() {
+			Profiler &profiler = instance();
+			std::unique_lock<std::mutex> lock(profiler.mutex);
+			std::ostringstream out;
+			out << "{\"traceEvents\":[";
+			for (unsigned i = 0; i < profiler.records.size(); i++) {
+				const Record &record = profiler.records[i];
+				auto start = std::chrono::duration_cast<std::chrono::microseconds>(record.start - profiler.origin).count();
+				auto end = std::chrono::duration_cast<std::chrono::microseconds>(record.end - profiler.origin).count();
+				out << (i > 0 ? ",\n" : "\n") << "{\"name\":\"" << record.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+					<< record.thread << ",\"ts\":" << start << ",\"dur\":" << (end - start) << ",\"args\":{\"id\":" << i
+					<< ",\"parent\":" << (record.parent == NO_RECORD ? -1 : (long long) record.parent)
+					<< ",\"calls\":" << record.calls << ",\"busyUs\":" << record.duration / 1000
+					<< ",\"blockedUs\":" << record.blocked / 1000 << ",\"bytes\":" << record.bytes
+					<< ",\"flops\":" << record.flops << "}}";
+			}
+			out << "\n]}\n";
+			return out.str();
+		}
+
+	private:
+		static Profiler &instance() {
+			//Never destroyed, so that it can be used until the end of the program
+			static Profiler *profiler = new Profiler();
+			return *profiler;
+		}
+
+		static unsigned &currentRecord() {
+			static thread_local unsigned record = NO_RECORD;
+			return record;
+		}
+
+		static void add(long long Record::*field, long long value) {
+			if (isEnabled() && currentRecord() != NO_RECORD) {
+				Profiler &profiler = instance();
+				std::unique_lock<std::mutex> lock(profiler.mutex);
+				if (currentRecord() < profiler.records.size()) {
+					profiler.records[currentRecord()].*field += value;
+				}
+			}
+		}
+
+		static double milliseconds(long long nanoseconds) {
+			return nanoseconds / 1e6;
+		}
+
+		unsigned open(const void *node, const std::string &name, unsigned parent, bool aggregate, Clock::time_point begin) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (parent != NO_RECORD && parent >= this->records.size()) {
+				//The parent was recorded before the last start()
+				parent = NO_RECORD;
+			}
+			if (aggregate) {
+				auto found = this->aggregated.find(std::make_pair(parent, node));
+				if (found != this->aggregated.end()) {
+					return found->second;
+				}
+			}
+			unsigned id = (unsigned) this->records.size();
+			this->records.emplace_back();
+			Record &record = this->records.back();
+			record.parent = parent;
+			record.name = name;
+			record.node = node;
+			record.start = begin;
+			record.end = begin;
+			std::ostringstream thread;
+			thread << std::this_thread::get_id();
+			record.thread = this->threads.emplace(thread.str(), (unsigned) this->threads.size()).first->second;
+			if (aggregate) {
+				this->aggregated[std::make_pair(parent, node)] = id;
+			}
+			return id;
+		}
+
+		void close(unsigned id, Clock::time_point begin, Clock::time_point end) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (id >= this->records.size()) {
+				return;
+			}
+			Record &record = this->records[id];
+			record.end = std::max(record.end, end);
+			record.duration += std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+			record.calls++;
+			record.finished = true;
+		}
+
+		void printText(std::ostringstream &out, unsigned id, unsigned depth) {
+			const Record &record = this->records[id];
+			auto start = std::chrono::duration_cast<std::chrono::microseconds>(record.start - this->origin).count();
+			out << std::string(depth * 2, ' ') << record.name << " [thread " << record.thread << "] start " << start / 1000.0
+				<< " ms, busy " << milliseconds(record.duration) << " ms, blocked " << milliseconds(record.blocked) << " ms, "
+				<< record.bytes << " bytes, " << record.flops << " flops";
+			if (record.calls > 1) {
+				out << " (" << record.calls << " calls)";
+			}
+			if (!record.finished) {
+				out << " (running)";
+			}
+			out << "\n";
+			for (unsigned i = id + 1; i < this->records.size(); i++) {
+				if (this->records[i].parent == id) {
+					this->printText(out, i, depth + 1);
+				}
+			}
+		}
+};
+
+#endif //MATRIX_PROFILER_H
@@ -0,0 +1,297 @@
+#ifndef MATRIX_REDUCTION_H
+#define MATRIX_REDUCTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+#include "MatrixData.h"
+#include "MatrixSpan.h"
+#include "ThreadPool.h"
+#include "Tuning.h"
+
+/**
+ * Reductions of whole matrices (sums, norms, extremes, dot products), see e.g. <code>Matrix::sum()</code>.
+ *
+ * The matrix is divided in strips of rows (or of columns, if it's short and wide), reduced in parallel on the
+ * <code>ThreadPool</code>; the partial results are then combined in pairs, as a tree. Each strip is read a block of rows
+ * at a time, in place when its rows are contiguous in memory, or materialized in a buffer otherwise (e.g. a lazy product).
+ * The inner loops keep LANES independent accumulators, so that the compiler can keep them in a vector register.
+ * @tparam T type of the data
+ */
+template<typename T>
+class Reduction {
+	public:
+		static const unsigned LANES = 8;
+
+		/**
+		 * Value and position of the minimum or of the maximum of a matrix
+		 */
+		struct Extreme {
+			T value;
+			unsigned row, col;
+			bool found;
+		};
+
+		template<class MD>
+		static T sum(const MD &matrix) {
+			return reduce(matrix.rows(), matrix.columns(), T(), tilesOf(matrix, [](T &partial, const MatrixTile<T> &tile) {
+				forEachRun(tile, [&partial](const T *values, unsigned length, unsigned, unsigned) {
+					partial += accumulate(values, length, [](T value) { return value; });
+				});
+			}), [](const T &a, const T &b) { return a + b; });
+		}
+
+		template<class MD>
+		static T sumOfSquares(const MD &matrix) {
+			return reduce(matrix.rows(), matrix.columns(), T(), tilesOf(matrix, [](T &partial, const MatrixTile<T> &tile) {
+				forEachRun(tile, [&partial](const T *values, unsigned length, unsigned, unsigned) {
+					partial += accumulate(values, length, [](T value) { return value * value; });
+				});
+			}), [](const T &a, const T &b) { return a + b; });
+		}
+
+		/**
+		 * @return the maximum of the sums of the absolute values of the columns
+		 */
+		template<class MD>
+		static T maxColumnSum(const MD &matrix) {
+			std::vector<T> sums = reduce(matrix.rows(), matrix.columns(), std::vector<T>(matrix.columns(), T()),
+										 tilesOf(matrix, [](std::vector<T> &partial, const MatrixTile<T> &tile) {
+				T *sums = partial.data() + tile.colOffset();
+				for (unsigned r = 0; r < tile.rows(); r++) {
+					const T *values = tile.row(r).data();
+					for (unsigned c = 0; c < tile.columns(); c++) {
+						sums[c] += absolute(values[c]);
+					}
+				}
+			}), addVectors);
+			return sums.empty() ? T() : *std::max_element(sums.begin(), sums.end());
+		}
+
+		/**
+		 * @return the maximum of the sums of the absolute values of the rows
+		 */
+		template<class MD>
+		static T maxRowSum(const MD &matrix) {
+			std::vector<T> sums = reduce(matrix.rows(), matrix.columns(), std::vector<T>(matrix.rows(), T()),
+										 tilesOf(matrix, [](std::vector<T> &partial, const MatrixTile<T> &tile) {
+				for (unsigned r = 0; r < tile.rows(); r++) {
+					partial[tile.rowOffset() + r] += accumulate(tile.row(r).data(), tile.columns(), [](T value) { return absolute(value); });
+				}
+			}), addVectors);
+			return sums.empty() ? T() : *std::max_element(sums.begin(), sums.end());
+		}
+
+		/**
+		 * @return the minimum (if less is std::less) or the maximum (if it's std::greater) of the matrix, with the position
+		 * of its first occurrence in row-major order
+		 */
+		template<class MD, class Less>
+		static Extreme extreme(const MD &matrix, Less less) {
+			Extreme none = {T(), 0, 0, false};
+			Extreme ret = reduce(matrix.rows(), matrix.columns(), none, tilesOf(matrix, [less](Extreme &partial, const MatrixTile<T> &tile) {
+				forEachRun(tile, [&partial, &less, &tile](const T *values, unsigned length, unsigned row, unsigned col) {
+					T lanes[LANES];
+					std::fill(lanes, lanes + LANES, values[0]);
+					unsigned i = 0;
+					for (; i + LANES <= length; i += LANES) {
+						for (unsigned j = 0; j < LANES; j++) {
+							lanes[j] = less(values[i + j], lanes[j]) ? values[i + j] : lanes[j];
+						}
+					}
+					T best = values[0];
+					for (; i < length; i++) {
+						best = less(values[i], best) ? values[i] : best;
+					}
+					for (unsigned j = 0; j < LANES; j++) {
+						best = less(lanes[j], best) ? lanes[j] : best;
+					}
+					if (!partial.found || less(best, partial.value)) {
+						//The first occurrence is looked for only when the run improves the result
+						unsigned index = (unsigned) (std::find_if(values, values + length, [&best, &less](T value) {
+							return !less(value, best) && !less(best, value);
+						}) - values);
+						index = index < length ? index : 0;
+						partial = {values[index], row + index / tile.columns(), col + index % tile.columns(), true};
+					}
+				});
+			}), [less](const Extreme &a, const Extreme &b) {
+				if (!b.found) {
+					return a;
+				} else if (!a.found || less(b.value, a.value)) {
+					return b;
+				} else if (!less(a.value, b.value) && std::make_pair(b.row, b.col) < std::make_pair(a.row, a.col)) {
+					return b;
+				}
+				return a;
+			});
+			if (!ret.found) {
+				Utils::error("The matrix is empty");
+			}
+			return ret;
+		}
+
+		/**
+		 * @return the sum of the products of the cells of two matrices of the same size
+		 */
+		template<class MD1, class MD2>
+		static T dot(const MD1 &left, const MD2 &right) {
+			if (left.rows() != right.rows() || left.columns() != right.columns()) {
+				Utils::error("Dot product between matrices of different sizes");
+			}
+			auto newVisitor = [&left, &right] {
+				MatrixTileReader<T, MD1> leftReader(&left);
+				MatrixTileReader<T, MD2> rightReader(&right);
+				return [leftReader, rightReader](T &partial, unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) mutable {
+					MatrixTile<T> a = leftReader.read(rowOffset, colOffset, rows, columns);
+					MatrixTile<T> b = rightReader.read(rowOffset, colOffset, rows, columns);
+					if (isContiguous(a) && isContiguous(b)) {
+						partial += multiplyAccumulate(a.row(0).data(), b.row(0).data(), rows * columns);
+						return;
+					}
+					for (unsigned r = 0; r < rows; r++) {
+						partial += multiplyAccumulate(a.row(r).data(), b.row(r).data(), columns);
+					}
+				};
+			};
+			return reduce(left.rows(), left.columns(), T(), newVisitor, [](const T &a, const T &b) { return a + b; });
+		}
+
+		/**
+		 * @return the dot product of two arrays
+		 */
+		static T multiplyAccumulate(const T *left, const T *right, unsigned length) {
+			T lanes[LANES] = {};
+			unsigned i = 0;
+			for (; i + LANES <= length; i += LANES) {
+				for (unsigned j = 0; j < LANES; j++) {
+					lanes[j] += left[i + j] * right[i + j];
+				}
+			}
+			T ret = T();
+			for (; i < length; i++) {
+				ret += left[i] * right[i];
+			}
+			return ret + sumLanes(lanes);
+		}
+
+	private:
+		/**
+		 * Sums the lanes in pairs, as a tree
+		 */
+		static T sumLanes(T *lanes) {
+			for (unsigned step = LANES / 2; step > 0; step /= 2) {
+				for (unsigned j = 0; j < step; j++) {
+					lanes[j] += lanes[j + step];
+				}
+			}
+			return lanes[0];
+		}
+
+		/**
+		 * Reduces the blocks of a matrix of the given size. newVisitor() is called once for each strip, and returns the
+		 * function that accumulates a block of rows (partial, rowOffset, colOffset, rows, columns) on the result of the strip.
+		 */
+		template<class R, class V, class C>
+		static R reduce(unsigned rows, unsigned columns, const R &identity, V newVisitor, C combine) {
+			ThreadPool &pool = ThreadPool::instance();
+			std::size_t cells = (std::size_t) rows * columns;
+			if (cells == 0) {
+				return identity;
+			}
+			unsigned strips = (unsigned) std::min<std::size_t>(4 * pool.workerCount(), cells / PARALLEL_MATERIALIZE_MIN_CELLS);
+			bool byRows = rows >= strips || rows >= columns;
+			strips = std::max(1u, std::min(strips, byRows ? rows : columns));
+			std::size_t blockCells = std::max<std::size_t>(1, Tuning::instance().cacheSizes().l2 / 2 / sizeof(T));
+			std::vector<R> partials(strips, identity);
+			pool.parallelFor(strips, [&](unsigned strip) {
+				unsigned length = byRows ? rows : columns;
+				unsigned begin = (unsigned) ((unsigned long long) length * strip / strips);
+				unsigned end = (unsigned) ((unsigned long long) length * (strip + 1) / strips);
+				unsigned rowBegin = byRows ? begin : 0, rowEnd = byRows ? end : rows;
+				unsigned colOffset = byRows ? 0 : begin, width = byRows ? columns : end - begin;
+				unsigned blockRows = (unsigned) std::max<std::size_t>(1, blockCells / width);
+				auto visit = newVisitor();
+				for (unsigned row = rowBegin; row < rowEnd; row += blockRows) {
+					visit(partials[strip], row, colOffset, std::min(blockRows, rowEnd - row), width);
+				}
+			});
+			//Combining the neighbours in pairs, halving the partial results at each step
+			for (unsigned step = 1; step < strips; step *= 2) {
+				for (unsigned i = 0; i + step < strips; i += 2 * step) {
+					partials[i] = combine(partials[i], partials[i + step]);
+				}
+			}
+			return partials[0];
+		}
+
+		/**
+		 * @return a visitor factory for reduce(), that reads the blocks of the matrix as tiles and passes them to
+		 * accumulate(partial, tile)
+		 */
+		template<class MD, class F>
+		static auto tilesOf(const MD &matrix, F accumulate) {
+			return [&matrix, accumulate] {
+				MatrixTileReader<T, MD> reader(&matrix);
+				return [reader, accumulate](auto &partial, unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) mutable {
+					accumulate(partial, reader.read(rowOffset, colOffset, rows, columns));
+				};
+			};
+		}
+
+		/**
+		 * @return true if the rows of the tile are adjacent, so that it can be read as a single array
+		 */
+		static bool isContiguous(const MatrixTile<T> &tile) {
+			return tile.rows() == 1 || tile.strided().rowStride == (std::ptrdiff_t) tile.columns();
+		}
+
+		/**
+		 * Calls function(values, length, row, col) on the runs of contiguous cells of the tile, where (row, col) is the
+		 * position of the first cell in the matrix: a single run if the rows of the tile are adjacent, a run per row otherwise
+		 */
+		template<class F>
+		static void forEachRun(const MatrixTile<T> &tile, F function) {
+			if (isContiguous(tile)) {
+				function(tile.row(0).data(), tile.rows() * tile.columns(), tile.rowOffset(), tile.colOffset());
+				return;
+			}
+			for (unsigned r = 0; r < tile.rows(); r++) {
+				function(tile.row(r).data(), tile.columns(), tile.rowOffset() + r, tile.colOffset());
+			}
+		}
+
+		/**
+		 * @return the sum of transform(value) over the array
+		 */
+		template<class F>
+		static T accumulate(const T *values, unsigned length, F transform) {
+			T lanes[LANES] = {};
+			unsigned i = 0;
+			for (; i + LANES <= length; i += LANES) {
+				for (unsigned j = 0; j < LANES; j++) {
+					lanes[j] += transform(values[i + j]);
+				}
+			}
+			T ret = T();
+			for (; i < length; i++) {
+				ret += transform(values[i]);
+			}
+			return ret + sumLanes(lanes);
+		}
+
+		static T absolute(T value) {
+			return value < T() ? -value : value;
+		}
+
+		static std::vector<T> addVectors(const std::vector<T> &a, const std::vector<T> &b) {
+			std::vector<T> ret = a;
+			for (std::size_t i = 0; i < ret.size(); i++) {
+				ret[i] += b[i];
+			}
+			return ret;
+		}
+};
+
+#endif //MATRIX_REDUCTION_H
@@ -0,0 +1,316 @@
+#ifndef MATRIX_SPARSEMD_H
+#define MATRIX_SPARSEMD_H
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "MatrixData.h"
+
+/**
+ * A cell of a sparse matrix, used to build it
+ */
+template<typename T>
+struct Triplet {
+	unsigned row, col;
+	T value;
+};
+
+/**
+ * Immutable implementation of <code>MatrixData</code> that stores only the nonzero cells, in the compressed sparse row
+ * (CSR) or compressed sparse column (CSC) format.
+ *
+ * In the CSR format, the nonzero cells of the row r are at the positions from offsets[r] to offsets[r + 1] of indices
+ * (their columns, sorted) and values. The CSC format is the same, swapping rows and columns.
+ * The memory is proportional to the number of nonzero cells, and it's shared between the copies.
+ *
+ * When an operand of a multiplication is sparse, <code>OptimizedMultiplyMD</code> uses the kernels of this class
+ * (multiplyDense() and multiplyByDense()), whose cost is proportional to the number of nonzero cells.
+ * @tparam T type of the data
+ */
+template<typename T>
+class SparseMatrixData : public MatrixData<T> {
+
+	public:
+		enum Format {
+			CSR, CSC
+		};
+
+	private:
+		struct Storage {
+			std::vector<std::size_t> offsets;
+			std::vector<unsigned> indices;
+			std::vector<T> values;
+		};
+
+		Format format;
+		std::shared_ptr<const Storage> storage;
+
+		SparseMatrixData(unsigned rows, unsigned columns, Format format, std::shared_ptr<const Storage> storage) :
+				MatrixData<T>(rows, columns), format(format), storage(storage) {
+		}
+
+	public:
+		/**
+		 * Creates a matrix from its nonzero cells, in any order. The values of the duplicated cells are summed.
+		 * It takes O(nonzeros * log(nonzeros of a row)) time, and O(nonzeros + rows) memory.
+		 */
+		static SparseMatrixData<T> fromTriplets(unsigned rows, unsigned columns, const std::vector<Triplet<T>> &triplets,
+												Format format = CSR) {
+			unsigned majors = format == CSR ? rows : columns;
+			auto storage = std::make_shared<Storage>();
+			//Counting sort on the major index
+			std::vector<std::size_t> offsets(majors + 1, 0);
+			for (auto &triplet : triplets) {
+				if (triplet.row >= rows || triplet.col >= columns) {
+					Utils::error("Illegal bounds");
+				}
+				offsets[(format == CSR ? triplet.row : triplet.col) + 1]++;
+			}
+			for (unsigned major = 0; major < majors; major++) {
+				offsets[major + 1] += offsets[major];
+			}
+			std::vector<std::pair<unsigned, T>> entries(triplets.size());
+			std::vector<std::size_t> next(offsets.begin(), offsets.end() - 1);
+			for (auto &triplet : triplets) {
+				unsigned major = format == CSR ? triplet.row : triplet.col;
+				entries[next[major]++] = std::make_pair(format == CSR ? triplet.col : triplet.row, triplet.value);
+			}
+			//Sorting each row (or column), summing the duplicates and dropping the zeros
+			storage->offsets.push_back(0);
+			for (unsigned major = 0; major < majors; major++) {
+				auto begin = entries.begin() + offsets[major], end = entries.begin() + offsets[major + 1];
+				std::sort(begin, end, [](const std::pair<unsigned, T> &a, const std::pair<unsigned, T> &b) {
+					return a.first < b.first;
+				});
+				for (auto it = begin; it != end;) {
+					unsigned minor = it->first;
+					T value = T();
+					for (; it != end && it->first == minor; it++) {
+						value += it->second;
+					}
+					if (value != T()) {
+						storage->indices.push_back(minor);
+						storage->values.push_back(value);
+					}
+				}
+				storage->offsets.push_back(storage->indices.size());
+			}
+			return SparseMatrixData<T>(rows, columns, format, storage);
+		}
+
+		/**
+		 * Creates a sparse copy of the given matrix, keeping its nonzero cells
+		 */
+		static SparseMatrixData<T> fromDense(const MatrixData<T> &matrix, Format format = CSR) {
+			VectorMatrixData<T> dense = matrix.virtualMaterialize(0, 0, matrix.rows(), matrix.columns());
+			std::vector<Triplet<T>> triplets;
+			for (unsigned r = 0; r < matrix.rows(); r++) {
+				for (unsigned c = 0; c < matrix.columns(); c++) {
+					T value = dense.get(r, c);
+					if (value != T()) {
+						triplets.push_back({r, c, value});
+					}
+				}
+			}
+			return fromTriplets(matrix.rows(), matrix.columns(), triplets, format);
+		}
+
+		Format getFormat() const {
+			return this->format;
+		}
+
+		/**
+		 * @return the number of cells that are stored
+		 */
+		std::size_t nonZeros() const {
+			return this->storage->values.size();
+		}
+
+		T get(unsigned row, unsigned col) const {
+			unsigned major = this->format == CSR ? row : col, minor = this->format == CSR ? col : row;
+			auto begin = this->storage->indices.begin() + this->storage->offsets[major];
+			auto end = this->storage->indices.begin() + this->storage->offsets[major + 1];
+			auto found = std::lower_bound(begin, end, minor);
+			if (found == end || *found != minor) {
+				return T();
+			}
+			return this->storage->values[found - this->storage->indices.begin()];
+		}
+
+		StridedData<T> strided() const {
+			return StridedData<T>();
+		}
+
+		StridedData<T> virtualGetStrided() const override {
+			return this->strided();
+		}
+
+		const SparseMatrixData<T> *virtualGetSparse() const override {
+			return this;
+		}
+
+		/**
+		 * Reading a cell costs a binary search, but the operands of a multiplication are read only at the nonzero cells
+		 */
+		double virtualGetAccessCost() const override {
+			return (double) this->nonZeros() / std::max(1.0, (double) this->rows() * this->columns());
+		}
+
+		void virtualMaterializeInto(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns,
+									const StridedData<T> &destination) const override {
+			if (rowOffset + rows > this->rows() || colOffset + columns > this->columns()) {
+				Utils::error("Illegal bounds");
+			}
+			for (unsigned r = 0; r < rows; r++) {
+				for (unsigned c = 0; c < columns; c++) {
+					*destination.at(r, c) = T();
+				}
+			}
+			//Scattering the nonzero cells of the region
+			bool csr = this->format == CSR;
+			unsigned majorBegin = csr ? rowOffset : colOffset, majorEnd = majorBegin + (csr ? rows : columns);
+			unsigned minorBegin = csr ? colOffset : rowOffset, minorEnd = minorBegin + (csr ? columns : rows);
+			for (unsigned major = majorBegin; major < majorEnd; major++) {
+				std::size_t begin, end;
+				this->range(major, minorBegin, minorEnd, begin, end);
+				for (std::size_t i = begin; i < end; i++) {
+					unsigned minor = this->storage->indices[i];
+					T *cell = csr ? destination.at(major - rowOffset, minor - colOffset) : destination.at(minor - rowOffset, major - colOffset);
+					*cell = this->storage->values[i];
+				}
+			}
+		}
+
+		VectorMatrixData<T> virtualMaterialize(unsigned rowOffset, unsigned colOffset, unsigned rows, unsigned columns) const override {
+			VectorMatrixData<T> ret = VectorMatrixData<T>::uninitialized(rows, columns);
+			this->virtualMaterializeInto(rowOffset, colOffset, rows, columns, ret.strided());
+			return ret;
+		}
+
+		SparseMatrixData<T> copy() const {
+			//The storage is immutable, so it can be shared
+			return *this;
+		}
+
+		/**
+		 * Computes the rows from rowOffset to rowOffset + rows of the product between this matrix and the given dense one,
+		 * which has as many rows as this matrix has columns. With a single column, this is a sparse matrix-vector product.
+		 * @return the number of multiply-adds performed
+		 */
+		long long multiplyDense(unsigned rowOffset, unsigned rows, const StridedData<T> &dense, unsigned columns,
+								const StridedData<T> &result) const {
+			clear(rows, columns, result);
+			const Storage &s = *this->storage;
+			long long operations = 0;
+			if (this->format == CSR) {
+				for (unsigned r = 0; r < rows; r++) {
+					T *output = result.at(r, 0);
+					std::size_t begin = s.offsets[rowOffset + r], end = s.offsets[rowOffset + r + 1];
+					if (columns == 1) {
+						T sum = T();
+						for (std::size_t i = begin; i < end; i++) {
+							sum += s.values[i] * *dense.at(s.indices[i], 0);
+						}
+						*output = sum;
+					} else {
+						for (std::size_t i = begin; i < end; i++) {
+							axpy(s.values[i], dense, s.indices[i], columns, result, r);
+						}
+					}
+					operations += (long long) (end - begin) * columns;
+				}
+			} else {
+				//Every column k of this matrix contributes to the rows of the result with the row k of the dense matrix
+				for (unsigned k = 0; k < this->columns(); k++) {
+					std::size_t begin, end;
+					this->range(k, rowOffset, rowOffset + rows, begin, end);
+					for (std::size_t i = begin; i < end; i++) {
+						axpy(s.values[i], dense, k, columns, result, s.indices[i] - rowOffset);
+					}
+					operations += (long long) (end - begin) * columns;
+				}
+			}
+			return operations;
+		}
+
+		/**
+		 * Computes the product between the given dense matrix, which has as many columns as this matrix has rows, and this
+		 * matrix. With a single row, this is a sparse vector-matrix product.
+		 * @return the number of multiply-adds performed
+		 */
+		long long multiplyByDense(const StridedData<T> &dense, unsigned rows, const StridedData<T> &result) const {
+			unsigned columns = this->columns();
+			clear(rows, columns, result);
+			const Storage &s = *this->storage;
+			long long operations = 0;
+			if (this->format == CSR) {
+				//The row k of this matrix is added to each row r of the result, multiplied by dense(r, k)
+				for (unsigned r = 0; r < rows; r++) {
+					for (unsigned k = 0; k < this->rows(); k++) {
+						T value = *dense.at(r, k);
+						if (value == T()) {
+							continue;
+						}
+						T *output = result.at(r, 0);
+						for (std::size_t i = s.offsets[k]; i < s.offsets[k + 1]; i++) {
+							output[s.indices[i] * result.colStride] += value * s.values[i];
+						}
+						operations += (long long) (s.offsets[k + 1] - s.offsets[k]);
+					}
+				}
+			} else {
+				//Each cell of the result is the dot product between a row of the dense matrix and a sparse column
+				for (unsigned c = 0; c < columns; c++) {
+					std::size_t begin = s.offsets[c], end = s.offsets[c + 1];
+					for (unsigned r = 0; r < rows; r++) {
+						T sum = T();
+						for (std::size_t i = begin; i < end; i++) {
+							sum += *dense.at(r, s.indices[i]) * s.values[i];
+						}
+						*result.at(r, c) = sum;
+					}
+					operations += (long long) (end - begin) * rows;
+				}
+			}
+			return operations;
+		}
+
+	private:
+		/**
+		 * Finds the positions of the cells of the given row (or column) whose index is in [minorBegin, minorEnd)
+		 */
+		void range(unsigned major, unsigned minorBegin, unsigned minorEnd, std::size_t &begin, std::size_t &end) const {
+			auto first = this->storage->indices.begin() + this->storage->offsets[major];
+			auto last = this->storage->indices.begin() + this->storage->offsets[major + 1];
+			begin = std::lower_bound(first, last, minorBegin) - this->storage->indices.begin();
+			end = std::lower_bound(first, last, minorEnd) - this->storage->indices.begin();
+		}
+
+		static void clear(unsigned rows, unsigned columns, const StridedData<T> &result) {
+			for (unsigned r = 0; r < rows; r++) {
+				for (unsigned c = 0; c < columns; c++) {
+					*result.at(r, c) = T();
+				}
+			}
+		}
+
+		/**
+		 * result(resultRow, :) += value * dense(denseRow, :)
+		 */
+		static void axpy(T value, const StridedData<T> &dense, unsigned denseRow, unsigned columns, const StridedData<T> &result,
+						 unsigned resultRow) {
+			T *output = result.at(resultRow, 0);
+			const T *input = dense.at(denseRow, 0);
+			if (dense.hasContiguousRows() && result.hasContiguousRows()) {
+				for (unsigned c = 0; c < columns; c++) {
+					output[c] += value * input[c];
+				}
+			} else {
+				for (unsigned c = 0; c < columns; c++) {
+					output[c * result.colStride] += value * input[c * dense.colStride];
+				}
+			}
+		}
+};
+
+#endif //MATRIX_SPARSEMD_H
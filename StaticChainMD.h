@@ -0,0 +1,203 @@
+#ifndef MATRIX_STATICCHAINMD_H
+#define MATRIX_STATICCHAINMD_H
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "MatrixData.h"
+#include "StaticMultiplyMD.h"
+
+/**
+ * List of the dimensions of a chain of multiplications: matrix i has size at(i) x at(i + 1)
+ */
+template<unsigned... DIMS>
+struct Dimensions {
+	static const unsigned MATRICES = sizeof...(DIMS) - 1;
+
+	static constexpr unsigned at(unsigned i) {
+		const unsigned dimensions[] = {DIMS...};
+		return dimensions[i];
+	}
+};
+
+/**
+ * Optimal order of a chain of N multiplications: the product of the matrices from i to j (both included) is split
+ * after the matrix split[i][j]
+ */
+template<unsigned N>
+struct ChainPlan {
+	unsigned long long cost[N][N];
+	unsigned split[N][N];
+
+	constexpr ChainPlan() : cost(), split() {}
+};
+
+/**
+ * Finds the optimal order of the multiplications at compile time, with the same dynamic programming algorithm used at
+ * runtime by <code>MultiplyMD</code>. Each operand costs one per cell to be read, since its type doesn't tell its cost.
+ */
+template<class Dims>
+struct ChainOrder;
+
+template<unsigned... DIMS>
+struct ChainOrder<Dimensions<DIMS...>> {
+	static constexpr ChainPlan<sizeof...(DIMS) - 1> plan() {
+		const unsigned long long dimensions[] = {DIMS...};
+		const unsigned n = sizeof...(DIMS) - 1;
+		ChainPlan<n> plan;
+		for (unsigned length = 2; length <= n; length++) {
+			for (unsigned i = 0; i + length <= n; i++) {
+				unsigned j = i + length - 1;
+				for (unsigned s = i; s < j; s++) {
+					unsigned long long c = plan.cost[i][s] + plan.cost[s + 1][j] + dimensions[i] * dimensions[s + 1] +
+										   dimensions[s + 1] * dimensions[j + 1] + 2 * dimensions[i] * dimensions[s + 1] * dimensions[j + 1];
+					if (s == i || c < plan.cost[i][j]) {
+						plan.cost[i][j] = c;
+						plan.split[i][j] = s;
+					}
+				}
+			}
+		}
+		return plan;
+	}
+
+	static constexpr ChainPlan<sizeof...(DIMS) - 1> PLAN = plan();
+};
+
+template<unsigned... DIMS>
+constexpr ChainPlan<sizeof...(DIMS) - 1> ChainOrder<Dimensions<DIMS...>>::PLAN;
+
+/**
+ * Node of the statically typed tree that multiplies the operands from I to J (both included), in the optimal order
+ */
+template<typename T, class Dims, class Operands, unsigned I, unsigned J, bool LEAF = I == J>
+struct StaticChainNode {
+	static const unsigned SPLIT = ChainOrder<Dims>::PLAN.split[I][J];
+
+	typedef StaticChainNode<T, Dims, Operands, I, SPLIT> Left;
+	typedef StaticChainNode<T, Dims, Operands, SPLIT + 1, J> Right;
+	typedef typename StaticProduct<T, Dims::at(I), Dims::at(SPLIT + 1), Dims::at(J + 1),
+			typename Left::type, typename Right::type>::type type;
+
+	static type build(const Operands &operands) {
+		return type(Left::build(operands), Right::build(operands));
+	}
+};
+
+template<typename T, class Dims, class Operands, unsigned I, unsigned J>
+struct StaticChainNode<T, Dims, Operands, I, J, true> {
+	typedef typename std::tuple_element<I, Operands>::type type;
+
+	static type build(const Operands &operands) {
+		return std::get<I>(operands);
+	}
+};
+
+/**
+ * Implementation of <code>MatrixData</code> that exposes a chain of multiplications between matrices whose sizes are
+ * known at compile time (e.g. <code>StaticSizeMatrix</code>).
+ *
+ * The order of the multiplications is chosen at compile time by <code>ChainOrder</code>, and the tree of the
+ * multiplications is a type, built from <code>StaticMultiplyMD</code> (small products) and
+ * <code>FixedOrderMultiplyMD</code> (large ones): there is no planning at runtime, and reading the cells of a small
+ * chain is fully inlined.
+ * @tparam T type of the data
+ * @tparam Dims the <code>Dimensions</code> of the chain
+ * @tparam MDs the types of the operands
+ */
+template<typename T, class Dims, class... MDs>
+class StaticChainMD : public MatrixData<T> {
+
+	public:
+		typedef std::tuple<MDs...> Operands;
+		typedef StaticChainNode<T, Dims, Operands, 0, sizeof...(MDs) - 1> Tree;
+
+	private:
+		Operands operands;
+		typename Tree::type root;
+
+		template<std::size_t... I>
+		Operands copyOperands(std::index_sequence<I...>) const {
+			return Operands(std::get<I>(this->operands).copy()...);
+		}
+
+	public:
+		explicit StaticChainMD(const Operands &operands) :
+				MatrixData<T>(Dims::at(0), Dims::at(sizeof...(MDs))), operands(operands), root(Tree::build(operands)) {
+		}
+
+		MATERIALIZE_IMPL
+
+		/**
+		 * @return the operands of the chain, used to append it to a longer chain
+		 */
+		const Operands &getOperands() const {
+			return this->operands;
+		}
+
+		StridedData<T> strided() const {
+			return this->root.strided();
+		}
+
+		std::vector<const MatrixData<T> *> virtualGetChildren() const override {
+			return {&this->root};
+		}
+
+		StaticChainMD<T, Dims, MDs...> copy() const {
+			return StaticChainMD<T, Dims, MDs...>(this->copyOperands(std::index_sequence_for<MDs...>()));
+		}
+
+	private:
+		T doGet(unsigned row, unsigned col) const {
+			return this->root.get(row, col);
+		}
+};
+
+/**
+ * The chain of a ROWS x COLUMNS matrix: the matrix itself, or its operands when it is a chain
+ */
+template<typename T, unsigned ROWS, unsigned COLUMNS, class MD>
+struct StaticChainOf {
+	typedef Dimensions<ROWS, COLUMNS> Dims;
+	typedef std::tuple<MD> Operands;
+
+	static Operands operands(const MD &matrix) {
+		return Operands(matrix);
+	}
+};
+
+template<typename T, unsigned ROWS, unsigned COLUMNS, class D, class... MDs>
+struct StaticChainOf<T, ROWS, COLUMNS, StaticChainMD<T, D, MDs...>> {
+	typedef D Dims;
+	typedef std::tuple<MDs...> Operands;
+
+	static Operands operands(const StaticChainMD<T, D, MDs...> &chain) {
+		return chain.getOperands();
+	}
+};
+
+template<typename T, class Dims1, class Dims2, class Operands1, class Operands2>
+struct StaticChainJoin;
+
+template<typename T, unsigned... DIMS1, unsigned SHARED, unsigned... DIMS2, class... MDs1, class... MDs2>
+struct StaticChainJoin<T, Dimensions<DIMS1...>, Dimensions<SHARED, DIMS2...>, std::tuple<MDs1...>, std::tuple<MDs2...>> {
+	typedef StaticChainMD<T, Dimensions<DIMS1..., DIMS2...>, MDs1..., MDs2...> type;
+};
+
+/**
+ * The chain that multiplies a ROWS x DEPTH and a DEPTH x COLUMNS matrix, appending the operands of the matrices that are
+ * chains themselves
+ */
+template<typename T, unsigned ROWS, unsigned DEPTH, unsigned COLUMNS, class MD1, class MD2>
+struct StaticChainProduct {
+	typedef StaticChainOf<T, ROWS, DEPTH, MD1> Left;
+	typedef StaticChainOf<T, DEPTH, COLUMNS, MD2> Right;
+	typedef typename StaticChainJoin<T, typename Left::Dims, typename Right::Dims, typename Left::Operands,
+			typename Right::Operands>::type type;
+
+	static type multiply(const MD1 &left, const MD2 &right) {
+		return type(std::tuple_cat(Left::operands(left), Right::operands(right)));
+	}
+};
+
+#endif //MATRIX_STATICCHAINMD_H
@@ -0,0 +1,113 @@
+#ifndef MATRIX_STATICKERNELS_H
+#define MATRIX_STATICKERNELS_H
+
+#include <array>
+#include <utility>
+#include "MatrixData.h"
+#include "SumMD.h"
+
+/**
+ * Kernels for matrices whose sizes are known at compile time, used by the products of small <code>StaticSizeMatrix</code>.
+ *
+ * The loops over rows and depth are unrolled with <code>std::index_sequence</code>, while the innermost loop over the
+ * columns has a constant trip count, so the compiler vectorizes it. All the buffers are row-major.
+ * Operands are read with <code>load()</code>, whose overloads are chosen on the type of the expression: sums and
+ * transpositions are evaluated with the kernels below, everything else is read through its memory or its get(r, c),
+ * which are inlined since the types are static.
+ * @tparam T type of the data
+ */
+template<typename T>
+struct StaticKernels {
+	/**
+	 * result = left * right, where left is R x K and right is K x C
+	 */
+	template<unsigned R, unsigned K, unsigned C>
+	static void multiply(const T *left, const T *right, T *result) {
+		auto row = [left, right, result](unsigned i) {
+			std::array<T, C> accumulator{};
+			auto step = [left, right, i, &accumulator](unsigned k) {
+				T value = left[i * K + k];
+				const T *input = right + k * C;
+				for (unsigned j = 0; j < C; j++) {
+					accumulator[j] += value * input[j];
+				}
+			};
+			unroll(step, std::make_index_sequence<K>());
+			for (unsigned j = 0; j < C; j++) {
+				result[i * C + j] = accumulator[j];
+			}
+		};
+		unroll(row, std::make_index_sequence<R>());
+	}
+
+	/**
+	 * result = left + right, element by element. result can be one of the operands
+	 */
+	template<unsigned N>
+	static void add(const T *left, const T *right, T *result) {
+		for (unsigned i = 0; i < N; i++) {
+			result[i] = left[i] + right[i];
+		}
+	}
+
+	/**
+	 * Writes the transposed of the R x C input into the C x R result
+	 */
+	template<unsigned R, unsigned C>
+	static void transpose(const T *input, T *result) {
+		auto row = [input, result](unsigned i) {
+			for (unsigned j = 0; j < C; j++) {
+				result[j * R + i] = input[i * C + j];
+			}
+		};
+		unroll(row, std::make_index_sequence<R>());
+	}
+
+	/**
+	 * Writes the R x C matrix to the given buffer
+	 */
+	template<unsigned R, unsigned C, class MD>
+	static void load(const MD &matrix, T *destination) {
+		StridedData<T> memory = matrix.strided();
+		if (memory.isValid() && memory.hasContiguousRows()) {
+			auto row = [&memory, destination](unsigned i) {
+				const T *input = memory.at(i, 0);
+				for (unsigned j = 0; j < C; j++) {
+					destination[i * C + j] = input[j];
+				}
+			};
+			unroll(row, std::make_index_sequence<R>());
+		} else {
+			auto row = [&matrix, destination](unsigned i) {
+				for (unsigned j = 0; j < C; j++) {
+					destination[i * C + j] = matrix.get(i, j);
+				}
+			};
+			unroll(row, std::make_index_sequence<R>());
+		}
+	}
+
+	template<unsigned R, unsigned C, class MD1, class MD2>
+	static void load(const SumMDa<T, MD1, MD2> &matrix, T *destination) {
+		std::array<T, R * C> right;
+		load<R, C>(matrix.getLeft(), destination);
+		load<R, C>(matrix.getRight(), right.data());
+		add<R * C>(destination, right.data(), destination);
+	}
+
+	template<unsigned R, unsigned C, class MD>
+	static void load(const TransposedMD<T, MD> &matrix, T *destination) {
+		std::array<T, R * C> wrapped;
+		load<C, R>(matrix.getWrapped(), wrapped.data());
+		transpose<C, R>(wrapped.data(), destination);
+	}
+
+	private:
+		template<class F, std::size_t... I>
+		static void unroll(F &f, std::index_sequence<I...>) {
+			int expand[] = {0, (f((unsigned) I), 0)...};
+			(void) expand;
+		}
+};
+
+#endif //MATRIX_STATICKERNELS_H
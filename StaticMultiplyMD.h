@@ -0,0 +1,166 @@
+#ifndef MATRIX_STATICMULTIPLYMD_H
+#define MATRIX_STATICMULTIPLYMD_H
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include "MatrixData.h"
+#include "MultiplyMD.h"
+#include "StaticKernels.h"
+
+//Products of StaticSizeMatrix where each of the three matrices has at most this many cells are computed inline by
+//StaticMultiplyMD, instead of MultiplyMD
+const unsigned STATIC_MULTIPLY_MAX_CELLS = 256;
+
+/**
+ * Immutable implementation of <code>MatrixData</code> that holds ROWS x COLUMNS values inline, in a <code>std::array</code>.
+ * Since the values are not shared, copying it copies them.
+ * @tparam T type of the data
+ */
+template<unsigned ROWS, unsigned COLUMNS, typename T>
+class ArrayMatrixData : public MatrixData<T> {
+
+	private:
+		std::array<T, ROWS * COLUMNS> values;
+
+	public:
+		ArrayMatrixData() : MatrixData<T>(ROWS, COLUMNS), values() {
+		}
+
+		MATERIALIZE_IMPL
+
+		/**
+		 * @return the values, row-major
+		 */
+		T *data() {
+			return this->values.data();
+		}
+
+		StridedData<T> strided() const {
+			return StridedData<T>(const_cast<T *>(this->values.data()), COLUMNS, 1);
+		}
+
+		ArrayMatrixData<ROWS, COLUMNS, T> copy() const {
+			return *this;
+		}
+
+	private:
+		T doGet(unsigned row, unsigned col) const {
+			return this->values[row * COLUMNS + col];
+		}
+};
+
+/**
+ * Implementation of <code>MatrixData</code> that exposes the product of two small matrices, whose sizes are known at
+ * compile time: ROWS x DEPTH and DEPTH x COLUMNS.
+ *
+ * The product is computed the first time it's read, on the calling thread, with the unrolled kernels of
+ * <code>StaticKernels</code>, and kept in an <code>ArrayMatrixData</code>. There are no threads, no allocations and no
+ * virtual calls, unlike <code>MultiplyMD</code>, whose blocking is meant for large matrices.
+ * @tparam T type of the data
+ */
+template<typename T, unsigned ROWS, unsigned DEPTH, unsigned COLUMNS, class MD1, class MD2>
+class StaticMultiplyMD : public BiMatrixWrapper<T, MD1, MD2> {
+
+	private:
+		static const unsigned char NOT_COMPUTED = 0, COMPUTING = 1, COMPUTED = 2;
+
+		mutable ArrayMatrixData<ROWS, COLUMNS, T> result;
+		mutable std::atomic<unsigned char> state{NOT_COMPUTED};
+
+	public:
+		StaticMultiplyMD(MD1 left, MD2 right) : BiMatrixWrapper<T, MD1, MD2>(left, right, ROWS, COLUMNS) {
+			if (left.rows() != ROWS || left.columns() != DEPTH || right.rows() != DEPTH || right.columns() != COLUMNS) {
+				Utils::error("Multiplication should be performed on compatible matrices");
+			}
+		}
+
+		StaticMultiplyMD(const StaticMultiplyMD<T, ROWS, DEPTH, COLUMNS, MD1, MD2> &another) :
+				BiMatrixWrapper<T, MD1, MD2>(another) {
+			if (another.state.load(std::memory_order_acquire) == COMPUTED) {
+				this->result = another.result;
+				this->state.store(COMPUTED, std::memory_order_relaxed);
+			}
+		}
+
+		MATERIALIZE_IMPL
+
+		StridedData<T> strided() const {
+			this->compute();
+			return this->result.strided();
+		}
+
+		StaticMultiplyMD<T, ROWS, DEPTH, COLUMNS, MD1, MD2> copy() const {
+			return StaticMultiplyMD<T, ROWS, DEPTH, COLUMNS, MD1, MD2>(this->left.copy(), this->right.copy());
+		}
+
+	private:
+		T doGet(unsigned row, unsigned col) const {
+			this->compute();
+			return this->result.get(row, col);
+		}
+
+		/**
+		 * Computes the product, if it wasn't already. Concurrent readers wait for the first one to finish.
+		 */
+		void compute() const {
+			unsigned char current = this->state.load(std::memory_order_acquire);
+			if (current == COMPUTED) {
+				return;
+			}
+			if (current == NOT_COMPUTED && this->state.compare_exchange_strong(current, COMPUTING, std::memory_order_acquire)) {
+				std::array<T, ROWS * DEPTH> left;
+				std::array<T, DEPTH * COLUMNS> right;
+				StaticKernels<T>::template load<ROWS, DEPTH>(this->left, left.data());
+				StaticKernels<T>::template load<DEPTH, COLUMNS>(this->right, right.data());
+				StaticKernels<T>::template multiply<ROWS, DEPTH, COLUMNS>(left.data(), right.data(), this->result.data());
+				this->state.store(COMPUTED, std::memory_order_release);
+				return;
+			}
+			while (this->state.load(std::memory_order_acquire) != COMPUTED) {
+				std::this_thread::yield();
+			}
+		}
+};
+
+/**
+ * A <code>MultiplyMD</code> whose order has already been chosen: it is a single leaf in the chain of the multiplications
+ * that contain it, instead of adding its operands to the chain
+ * @tparam T type of the data
+ */
+template<typename T, class MD1, class MD2>
+class FixedOrderMultiplyMD : public MultiplyMD<T, MD1, MD2> {
+
+	private:
+		template<typename U, class MD3, class MD4> friend
+		class MultiplyMD;
+
+	public:
+		FixedOrderMultiplyMD(MD1 left, MD2 right) : MultiplyMD<T, MD1, MD2>(left, right) {
+		}
+
+		FixedOrderMultiplyMD<T, MD1, MD2> copy() const {
+			return FixedOrderMultiplyMD<T, MD1, MD2>(this->getLeft().copy(), this->getRight().copy());
+		}
+
+	protected:
+		void addToMultiplicationChain(std::vector<const MatrixData<T> *> &multiplicationChain) const {
+			multiplicationChain.push_back(this);
+		}
+};
+
+/**
+ * Chooses the implementation of the product of a ROWS x DEPTH and a DEPTH x COLUMNS matrix: small products are computed
+ * inline by <code>StaticMultiplyMD</code>, the others by <code>FixedOrderMultiplyMD</code>
+ */
+template<typename T, unsigned ROWS, unsigned DEPTH, unsigned COLUMNS, class MD1, class MD2>
+struct StaticProduct {
+	static const bool IS_SMALL = ROWS * DEPTH <= STATIC_MULTIPLY_MAX_CELLS && DEPTH * COLUMNS <= STATIC_MULTIPLY_MAX_CELLS &&
+								 ROWS * COLUMNS <= STATIC_MULTIPLY_MAX_CELLS;
+
+	typedef typename std::conditional<IS_SMALL, StaticMultiplyMD<T, ROWS, DEPTH, COLUMNS, MD1, MD2>,
+			FixedOrderMultiplyMD<T, MD1, MD2>>::type type;
+};
+
+#endif //MATRIX_STATICMULTIPLYMD_H
@@ -8,6 +8,7 @@
 #define MATRIX_STATICSIZEMATRIX_H
 
 #include "Matrix.h"
+#include "StaticChainMD.h"
 
 template<unsigned ROWS, unsigned COLUMNS, typename T, class MD = VectorMatrixData<T>>
 class StaticSizeMatrix : public Matrix<T, MD> {
@@ -100,13 +101,14 @@ class StaticSizeMatrix : public Matrix<T, MD> {
 		}
 
 		/**
-		 * Multiplies the two given matrices
+		 * Multiplies the two given matrices. The result is a <code>StaticChainMD</code>, that joins the chains of the operands:
+		 * the order of the multiplications is chosen at compile time
 		 */
 		template<unsigned C, class MD2>
-		const StaticSizeMatrix<ROWS, C, T, MultiplyMD<T, MD, MD2>>
+		const StaticSizeMatrix<ROWS, C, T, typename StaticChainProduct<T, ROWS, COLUMNS, C, MD, MD2>::type>
 		operator*(const StaticSizeMatrix<COLUMNS, C, T, MD2> &another) const {
-			return StaticSizeMatrix<ROWS, C, T, MultiplyMD<T, MD, MD2>>(
-					MultiplyMD<T, MD, MD2>(this->data, another.data));
+			typedef StaticChainProduct<T, ROWS, COLUMNS, C, MD, MD2> Product;
+			return StaticSizeMatrix<ROWS, C, T, typename Product::type>(Product::multiply(this->data, another.data));
 		}
 
 		using Matrix<T, MD>::operator*;
@@ -130,6 +132,35 @@ class StaticSizeMatrix : public Matrix<T, MD> {
 					SumMDa<T, MD, MD2>(this->data, another.data));
 		}
 
+		/**
+		 * Subtracts the given matrix from this one
+		 */
+		template<class MD2>
+		const StaticSizeMatrix<ROWS, COLUMNS, T, ZipMD<T, MD, MD2, std::minus<T>>>
+		operator-(const StaticSizeMatrix<ROWS, COLUMNS, T, MD2> &another) const {
+			return StaticSizeMatrix<ROWS, COLUMNS, T, ZipMD<T, MD, MD2, std::minus<T>>>(
+					ZipMD<T, MD, MD2, std::minus<T>>(this->data, another.data, std::minus<T>()));
+		}
+
+		using Matrix<T, MD>::operator-;
+
+		/**
+		 * Multiplies each cell by the given scalar
+		 */
+		const StaticSizeMatrix<ROWS, COLUMNS, T, MapMD<T, MD, Scale<T>>> operator*(const T &factor) const {
+			return StaticSizeMatrix<ROWS, COLUMNS, T, MapMD<T, MD, Scale<T>>>(MapMD<T, MD, Scale<T>>(this->data, Scale<T>{factor}));
+		}
+
+		/**
+		 * @return the Hadamard (elementwise) product of the two given matrices
+		 */
+		template<class MD2>
+		const StaticSizeMatrix<ROWS, COLUMNS, T, ZipMD<T, MD, MD2, std::multiplies<T>>>
+		hadamard(const StaticSizeMatrix<ROWS, COLUMNS, T, MD2> &another) const {
+			return StaticSizeMatrix<ROWS, COLUMNS, T, ZipMD<T, MD, MD2, std::multiplies<T>>>(
+					ZipMD<T, MD, MD2, std::multiplies<T>>(this->data, another.data, std::multiplies<T>()));
+		}
+
 		StaticSizeMatrix<ROWS, COLUMNS, T, VectorMatrixData<T>> copy() const {
 			return StaticSizeMatrix<ROWS, COLUMNS, T, VectorMatrixData<T>>(VectorMatrixData<T>::template toVector<MD>(this->data));
 		}
@@ -141,6 +172,15 @@ class StaticSizeMatrix : public Matrix<T, MD> {
 
 };
 
+/**
+ * Multiplies each cell of the matrix by the given scalar
+ */
+template<unsigned ROWS, unsigned COLUMNS, typename T, class MD>
+const StaticSizeMatrix<ROWS, COLUMNS, T, MapMD<T, MD, Scale<T>>>
+operator*(const typename std::common_type<T>::type &factor, const StaticSizeMatrix<ROWS, COLUMNS, T, MD> &matrix) {
+	return matrix * factor;
+}
+
 #endif //MATRIX_STATICSIZEMATRIX_H
 
 
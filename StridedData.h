@@ -0,0 +1,136 @@
+#ifndef MATRIX_STRIDEDDATA_H
+#define MATRIX_STRIDEDDATA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "BlockedTraversal.h"
+
+/**
+ * Describes a matrix that lies in memory with constant strides: the cell (r, c) is at <code>data[r * rowStride + c * colStride]</code>.
+ *
+ * Views over a <code>VectorMatrixData</code> (submatrix, transposed, diagonal) are affine transformations of the
+ * underlying vector, so they can expose their memory in this form. Kernels can then read and write the memory directly,
+ * instead of calling get(r, c) for each cell.
+ *
+ * A default-constructed instance is not valid: it is returned by the matrices that cannot be described in this way.
+ * @tparam T type of the data
+ */
+template<typename T>
+struct StridedData {
+	T *data;
+	std::ptrdiff_t rowStride, colStride;
+
+	StridedData() : data(NULL), rowStride(0), colStride(0) {}
+
+	StridedData(T *data, std::ptrdiff_t rowStride, std::ptrdiff_t colStride) : data(data), rowStride(rowStride), colStride(colStride) {}
+
+	/**
+	 * @return true if the matrix can be accessed through this object
+	 */
+	bool isValid() const {
+		return this->data != NULL;
+	}
+
+	/**
+	 * @return true if each row is contiguous in memory
+	 */
+	bool hasContiguousRows() const {
+		return this->colStride == 1;
+	}
+
+	T *at(unsigned row, unsigned col) const {
+		return this->data + row * this->rowStride + col * this->colStride;
+	}
+
+	/**
+	 * @return the memory of the submatrix that starts at the given cell
+	 */
+	StridedData<T> offset(unsigned row, unsigned col) const {
+		if (!this->isValid()) {
+			return StridedData<T>();
+		}
+		return StridedData<T>(this->at(row, col), this->rowStride, this->colStride);
+	}
+
+	/**
+	 * @return the memory of the transposed matrix
+	 */
+	StridedData<T> transposed() const {
+		return StridedData<T>(this->data, this->colStride, this->rowStride);
+	}
+
+	/**
+	 * @return the memory of the diagonal of this (square) matrix, as a vector
+	 */
+	StridedData<T> diagonal() const {
+		if (!this->isValid()) {
+			return StridedData<T>();
+		}
+		return StridedData<T>(this->data, this->rowStride + this->colStride, 0);
+	}
+
+	/**
+	 * Copies a region of the given size to the given destination
+	 */
+	void copyTo(unsigned rows, unsigned columns, const StridedData<T> &destination) const {
+		if (this->data == destination.data && this->rowStride == destination.rowStride && this->colStride == destination.colStride) {
+			//Copying a matrix onto itself
+			return;
+		}
+		if (this->hasContiguousRows() && destination.hasContiguousRows()) {
+			for (unsigned r = 0; r < rows; r++) {
+				std::memcpy(destination.at(r, 0), this->at(r, 0), columns * sizeof(T));
+			}
+		} else {
+			//The rows are strided (e.g. the source is transposed): copying in blocks that fit in the cache,
+			//so that this is an out-of-place cache-oblivious transposition
+			StridedData<T> source = *this;
+			auto copyCell = [source, destination](unsigned r, unsigned c) {
+				*destination.at(r, c) = *source.at(r, c);
+			};
+			BlockedTraversal::traverse(0, 0, rows, columns, copyCell);
+		}
+	}
+};
+
+/**
+ * The bytes spanned by a strided matrix, whatever the type of its cells: it's used to find out whether the memory that is
+ * written by an assignment is read by the expression that is assigned
+ */
+struct MemoryRegion {
+	const char *data;
+	std::ptrdiff_t rowStride, colStride;
+	//The first and the last byte, both included
+	std::uintptr_t first, last;
+
+	template<typename T>
+	MemoryRegion(const StridedData<T> &memory, unsigned rows, unsigned columns) :
+			data(reinterpret_cast<const char *>(memory.data)), rowStride(memory.rowStride * (std::ptrdiff_t) sizeof(T)),
+			colStride(memory.colStride * (std::ptrdiff_t) sizeof(T)), first(0), last(0) {
+		if (rows == 0 || columns == 0) {
+			this->data = NULL;
+			return;
+		}
+		std::ptrdiff_t lastRow = this->rowStride * (rows - 1), lastColumn = this->colStride * (columns - 1);
+		this->first = reinterpret_cast<std::uintptr_t>(this->data) + std::min<std::ptrdiff_t>(0, lastRow) +
+					  std::min<std::ptrdiff_t>(0, lastColumn);
+		this->last = reinterpret_cast<std::uintptr_t>(this->data) + std::max<std::ptrdiff_t>(0, lastRow) +
+					 std::max<std::ptrdiff_t>(0, lastColumn) + sizeof(T) - 1;
+	}
+
+	/**
+	 * @return true if writing this region could change the cells of the other one before they are read.
+	 * If sameCells is true, each cell of the other region is read right before writing the same cell of this one, so
+	 * the two regions can coincide.
+	 */
+	bool aliases(const MemoryRegion &other, bool sameCells) const {
+		if (this->data == NULL || other.data == NULL || this->last < other.first || other.last < this->first) {
+			return false;
+		}
+		return !(sameCells && this->data == other.data && this->rowStride == other.rowStride && this->colStride == other.colStride);
+	}
+};
+
+#endif //MATRIX_STRIDEDDATA_H
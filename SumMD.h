@@ -6,13 +6,14 @@
 #define MATRIX_SUMMD_H
 
 #include "OptimizableMD.h"
+#include "ElementwiseMD.h"
 
 /**
  * Implementation of <code>MatrixData</code> that exposes the sum of the two given matrices
  * @tparam T type of the data
  */
 template<typename T, class MD1, class MD2>
-class SumMDa : public BiMatrixWrapper<T, MD1, MD2> {
+class SumMDa : public BiMatrixWrapper<T, MD1, MD2>, public ElementwiseTag {
 	public:
 		SumMDa(MD1 left, MD2 right) : BiMatrixWrapper<T, MD1, MD2>(left, right, left.rows(), left.columns()) {
 			if (left.rows() != right.rows() || left.columns() != right.columns()) {
@@ -20,12 +21,27 @@ class SumMDa : public BiMatrixWrapper<T, MD1, MD2> {
 			}
 		}
 
-		MATERIALIZE_IMPL
+		ELEMENTWISE_MATERIALIZE_IMPL
+
+		const T *loadChunk(unsigned row, unsigned col, unsigned length, T *buffer) const {
+			return Elementwise<T>::zip(this->left, this->right, std::plus<T>(), row, col, length, buffer);
+		}
 
 		SumMDa<T, MD1, MD2> copy() const {
 			return SumMDa<T, MD1, MD2>(this->left.copy(), this->right.copy());
 		}
 
+		/**
+		 * Each cell reads only the same cell of the operands
+		 */
+		bool virtualAliases(const MemoryRegion &region, bool sameCells) const override {
+			return this->left.virtualAliases(region, sameCells) || this->right.virtualAliases(region, sameCells);
+		}
+
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint);
+		}
+
 	private:
 
 		T doGet(unsigned row, unsigned col) const {
@@ -38,7 +54,7 @@ class SumMDa : public BiMatrixWrapper<T, MD1, MD2> {
  * @tparam T type of the data
  */
 template<typename T, class MD>
-class MultiSumMD : public MultiMatrixWrapper<T, MD> {
+class MultiSumMD : public MultiMatrixWrapper<T, MD>, public ElementwiseTag {
 	public:
 		explicit MultiSumMD(std::deque<MD> wrapped) : MultiMatrixWrapper<T, MD>(wrapped, wrapped[0].rows(), wrapped[0].columns()) {
 			for (auto &m:wrapped) {
@@ -48,12 +64,40 @@ class MultiSumMD : public MultiMatrixWrapper<T, MD> {
 			}
 		}
 
-		MATERIALIZE_IMPL
+		ELEMENTWISE_MATERIALIZE_IMPL
+
+		const T *loadChunk(unsigned row, unsigned col, unsigned length, T *buffer) const {
+			alignas(64) T operandBuffer[Elementwise<T>::CHUNK];
+			const T *first = Elementwise<T>::load(this->wrapped[0], row, col, length, buffer);
+			if (first != buffer) {
+				std::copy(first, first + length, buffer);
+			}
+			for (auto it = this->wrapped.begin() + 1; it < this->wrapped.end(); it++) {
+				const T *operand = Elementwise<T>::load(*it, row, col, length, operandBuffer);
+				for (unsigned i = 0; i < length; i++) {
+					buffer[i] += operand[i];
+				}
+			}
+			return buffer;
+		}
 
 		MultiSumMD<T, MD> copy() const {
 			return MultiSumMD<T, MD>(this->copyWrapped());
 		}
 
+		bool virtualAliases(const MemoryRegion &region, bool sameCells) const override {
+			for (auto &m : this->wrapped) {
+				if (m.virtualAliases(region, sameCells)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool virtualFingerprint(Fingerprint &fingerprint) const override {
+			return this->appendFingerprint(fingerprint);
+		}
+
 	private:
 		T doGet(unsigned row, unsigned col) const {
 			T ret = 0;
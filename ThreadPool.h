@@ -0,0 +1,320 @@
+#ifndef MATRIX_THREADPOOL_H
+#define MATRIX_THREADPOOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Profiler.h"
+#include "Utils.h"
+
+/**
+ * Handle to a task submitted to the <code>ThreadPool</code>.
+ * Copies of the handle refer to the same task.
+ * @tparam R type of the result
+ */
+template<typename R>
+class PoolTask {
+	private:
+		friend class ThreadPool;
+
+		std::shared_future<R> future;
+		std::shared_ptr<std::packaged_task<R()>> task;
+		std::shared_ptr<std::atomic<bool>> claimed;
+
+	public:
+		PoolTask() = default;
+
+		/**
+		 * @return true if this handle refers to a task
+		 */
+		bool valid() const {
+			return this->future.valid();
+		}
+
+		/**
+		 * @return true if the task has been executed
+		 */
+		bool isReady() const {
+			return this->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		}
+
+		/**
+		 * @return the result of the task. Must be called after the task has been executed.
+		 */
+		const R &get() const {
+			return this->future.get();
+		}
+
+	private:
+		/**
+		 * Runs the task on the current thread, if no other thread has started it
+		 * @return true if the task was run by this call
+		 */
+		bool tryRun() const {
+			if (!this->claimed->exchange(true)) {
+				(*this->task)();
+				return true;
+			}
+			return false;
+		}
+};
+
+/**
+ * Work-stealing scheduler shared by the whole library.
+ *
+ * Every worker has its own queue: tasks submitted by a worker are pushed to its queue and are executed in LIFO order,
+ * while idle workers steal the oldest tasks from the other queues. Tasks submitted from outside the pool are put in a
+ * shared queue.
+ *
+ * A thread that waits for a task (see <code>wait()</code>) doesn't sleep if the task hasn't started yet: it takes the task
+ * and runs it itself. Running arbitrary queued tasks while waiting is not safe, since the lazy evaluation doesn't build a
+ * strict fork-join tree: a task could end up waiting for a task suspended below it on the same stack.
+ * Since the dependencies between tasks form a DAG, running only the awaited task can never deadlock.
+ *
+ * The number of workers defaults to the number of cores, and can be changed with the environment variable
+ * <code>MATRIX_THREADS</code> or with <code>setWorkerCount()</code>.
+ */
+class ThreadPool {
+	private:
+		struct TaskQueue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		//The last queue is the shared one, used by the threads that are not workers
+		std::vector<std::unique_ptr<TaskQueue>> queues;
+		std::vector<std::thread> workers;
+		std::mutex sleepMutex;
+		std::condition_variable sleepCondition;
+		std::atomic<unsigned> pendingTasks;
+		std::atomic<bool> stopping;
+
+	public:
+		explicit ThreadPool(unsigned workerCount) : pendingTasks(0), stopping(false) {
+			if (workerCount == 0) {
+				Utils::error("The thread pool needs at least one worker");
+			}
+			for (unsigned i = 0; i <= workerCount; i++) {
+				this->queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+			}
+			for (unsigned i = 0; i < workerCount; i++) {
+				this->workers.emplace_back([this, i] { this->workerLoop(i); });
+			}
+		}
+
+		ThreadPool(const ThreadPool &) = delete;
+
+		~ThreadPool() {
+			{
+				std::unique_lock<std::mutex> lock(this->sleepMutex);
+				this->stopping = true;
+			}
+			this->sleepCondition.notify_all();
+			for (auto &worker : this->workers) {
+				worker.join();
+			}
+		}
+
+		/**
+		 * @return the pool used by the library
+		 */
+		static ThreadPool &instance() {
+			return *holder();
+		}
+
+		/**
+		 * Replaces the pool used by the library with a new one with the given number of workers.
+		 * It must be called when no task is running.
+		 */
+		static void setWorkerCount(unsigned workerCount) {
+			holder().reset();
+			holder().reset(new ThreadPool(workerCount));
+		}
+
+		/**
+		 * @return the number of workers of this pool
+		 */
+		unsigned workerCount() const {
+			return (unsigned) this->workers.size();
+		}
+
+		/**
+		 * Schedules the given function on the pool
+		 * @return a handle to the task, that can be passed to <code>wait()</code>
+		 */
+		template<typename F>
+		PoolTask<typename std::result_of<F()>::type> submit(F function) {
+			typedef typename std::result_of<F()>::type R;
+			PoolTask<R> handle;
+			handle.task = std::make_shared<std::packaged_task<R()>>(function);
+			handle.future = handle.task->get_future().share();
+			handle.claimed = std::make_shared<std::atomic<bool>>(false);
+			int index = currentWorkerIndex();
+			//Threads that are not workers of this pool use the shared queue
+			TaskQueue &queue = *this->queues[index >= 0 && currentPool() == this ? index : this->workers.size()];
+			this->pendingTasks++;
+			{
+				std::unique_lock<std::mutex> lock(queue.mutex);
+				//The task could have been already executed by a thread waiting for it: in that case, it's skipped
+				queue.tasks.emplace_back([handle] { handle.tryRun(); });
+			}
+			{
+				//Locking, so that a worker cannot miss the notification between its check and its wait
+				std::unique_lock<std::mutex> lock(this->sleepMutex);
+			}
+			this->sleepCondition.notify_one();
+			return handle;
+		}
+
+		/**
+		 * Waits until the given task has been executed.
+		 * If no thread has started it yet, it's executed by the current thread.
+		 */
+		template<typename R>
+		void wait(const PoolTask<R> &task) {
+			if (!task.isReady() && !task.tryRun()) {
+				//The task is running on another thread
+				if (Profiler::isEnabled()) {
+					auto begin = std::chrono::steady_clock::now();
+					task.future.wait();
+					Profiler::addBlockedTime(std::chrono::steady_clock::now() - begin);
+				} else {
+					task.future.wait();
+				}
+			}
+		}
+
+		/**
+		 * Calls function(i) for each i from 0 to count - 1, in parallel: the calls are tasks of the pool, and the current
+		 * thread executes the first one. It returns when all the calls have finished, rethrowing their first exception.
+		 */
+		template<typename F>
+		void parallelFor(unsigned count, F function) {
+			std::vector<PoolTask<bool>> tasks;
+			for (unsigned i = 1; i < count; i++) {
+				tasks.push_back(this->submit([&function, i] {
+					function(i);
+					return true;
+				}));
+			}
+			std::exception_ptr error;
+			try {
+				if (count > 0) {
+					function(0);
+				}
+			} catch (...) {
+				error = std::current_exception();
+			}
+			//The tasks refer to the function, so all of them must finish before returning
+			for (auto &task : tasks) {
+				this->wait(task);
+				try {
+					task.get();
+				} catch (...) {
+					if (!error) {
+						error = std::current_exception();
+					}
+				}
+			}
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+	private:
+		/**
+		 * Runs a single queued task, if any.
+		 * The queue of the current worker is looked first, then the other queues.
+		 * @return true if a task was executed
+		 */
+		bool runPendingTask() {
+			std::function<void()> task;
+			if (this->takeTask(task)) {
+				task();
+				return true;
+			}
+			return false;
+		}
+
+		static std::unique_ptr<ThreadPool> &holder() {
+			static std::unique_ptr<ThreadPool> pool(new ThreadPool(defaultWorkerCount()));
+			return pool;
+		}
+
+		static unsigned defaultWorkerCount() {
+			const char *env = std::getenv("MATRIX_THREADS");
+			if (env != NULL && std::atoi(env) > 0) {
+				return (unsigned) std::atoi(env);
+			}
+			unsigned cores = std::thread::hardware_concurrency();
+			return cores > 0 ? cores : 1;
+		}
+
+		static int &currentWorkerIndex() {
+			static thread_local int index = -1;
+			return index;
+		}
+
+		static ThreadPool *&currentPool() {
+			static thread_local ThreadPool *pool = NULL;
+			return pool;
+		}
+
+		bool takeTask(std::function<void()> &task) {
+			if (this->pendingTasks == 0) {
+				return false;
+			}
+			unsigned queueCount = (unsigned) this->queues.size();
+			int index = currentPool() == this ? currentWorkerIndex() : -1;
+			if (index >= 0) {
+				//My own queue, newest task first
+				TaskQueue &own = *this->queues[index];
+				std::unique_lock<std::mutex> lock(own.mutex);
+				if (!own.tasks.empty()) {
+					task = std::move(own.tasks.back());
+					own.tasks.pop_back();
+					this->pendingTasks--;
+					return true;
+				}
+			}
+			//Stealing the oldest task from the other queues
+			unsigned start = index >= 0 ? (unsigned) index + 1 : 0;
+			for (unsigned i = 0; i < queueCount; i++) {
+				TaskQueue &victim = *this->queues[(start + i) % queueCount];
+				std::unique_lock<std::mutex> lock(victim.mutex);
+				if (!victim.tasks.empty()) {
+					task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					this->pendingTasks--;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void workerLoop(unsigned index) {
+			currentWorkerIndex() = index;
+			currentPool() = this;
+			while (true) {
+				if (this->runPendingTask()) {
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(this->sleepMutex);
+				this->sleepCondition.wait(lock, [this] { return this->stopping || this->pendingTasks > 0; });
+				if (this->stopping) {
+					return;
+				}
+			}
+		}
+};
+
+#endif //MATRIX_THREADPOOL_H
@@ -0,0 +1,367 @@
+#ifndef MATRIX_TUNING_H
+#define MATRIX_TUNING_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "GemmKernel.h"
+#include "ThreadPool.h"
+
+/**
+ * Sizes of the blocks in which a multiplication is divided: the left operand is split in blocks of rows x depth cells,
+ * the right one in blocks of depth x columns cells.
+ */
+struct BlockSizes {
+	unsigned rows, depth, columns;
+};
+
+/**
+ * Sizes of the data caches of the host, in bytes. The L3 size is the share of a single core.
+ */
+struct CacheSizes {
+	std::size_t l1, l2, l3;
+};
+
+/**
+ * Chooses the block sizes of the multiplication.
+ *
+ * By default they are derived from the cache sizes of the host (read from sysfs on Linux):
+ * - a panel of depth x NR cells of the right block stays in L1 while it's multiplied by the whole left block;
+ * - the packed left block (rows x depth) stays in L2;
+ * - the packed right block (depth x columns) stays in the share of L3 of a core.
+ * The sizes are then clamped to the shape of the operands, and reduced if there would be fewer blocks than workers.
+ *
+ * <code>autotune()</code> measures some candidates around these sizes, and keeps the fastest ones for each type and shape.
+ * The winners are saved to a profile file (by default <code>matrix-tuning.profile</code> in the working directory, or the
+ * path in the environment variable <code>MATRIX_TUNING_PROFILE</code>), loaded automatically the next time.
+ */
+class Tuning {
+	public:
+		/**
+		 * Classes of shapes of the operands, that are tuned separately
+		 */
+		enum Shape {
+			SQUARE, TALL, WIDE, SHALLOW
+		};
+
+		/**
+		 * Types whose large square products are computed with the Strassen-Winograd algorithm
+		 */
+		enum StrassenMode {
+			//Never
+			STRASSEN_OFF,
+			//Integral types, for which the result is exact
+			STRASSEN_EXACT,
+			//Also floating point types, whose rounding errors grow (a bit) with each level of the recursion
+			STRASSEN_ALL
+		};
+
+	private:
+		std::mutex mutex;
+		CacheSizes caches;
+		//Tuned sizes, by type and shape
+		std::map<std::pair<std::string, int>, BlockSizes> profile;
+		std::string profilePath;
+		StrassenMode strassenMode = STRASSEN_EXACT;
+		unsigned strassenCrossover = 2048;
+
+		Tuning() {
+			this->caches = detectCaches();
+			const char *env = std::getenv("MATRIX_TUNING_PROFILE");
+			this->profilePath = env != NULL ? env : "matrix-tuning.profile";
+			this->load(this->profilePath);
+			const char *strassen = std::getenv("MATRIX_STRASSEN");
+			if (strassen != NULL) {
+				std::string mode = strassen;
+				this->strassenMode = mode == "off" ? STRASSEN_OFF : mode == "all" ? STRASSEN_ALL : STRASSEN_EXACT;
+			}
+			const char *crossover = std::getenv("MATRIX_STRASSEN_CROSSOVER");
+			if (crossover != NULL && std::atoi(crossover) > 0) {
+				this->strassenCrossover = (unsigned) std::atoi(crossover);
+			}
+		}
+
+	public:
+		Tuning(const Tuning &) = delete;
+
+		static Tuning &instance() {
+			//Never destroyed, so that it can be used until the end of the program
+			static Tuning *tuning = new Tuning();
+			return *tuning;
+		}
+
+		CacheSizes cacheSizes() const {
+			return this->caches;
+		}
+
+		/**
+		 * @return the class of the shape of a product (m x k) * (k x n)
+		 */
+		static Shape shapeOf(unsigned m, unsigned k, unsigned n) {
+			if (k * 8 <= std::min(m, n)) {
+				return SHALLOW;
+			} else if (m >= 8 * std::max(k, n)) {
+				return TALL;
+			} else if (n >= 8 * std::max(m, k)) {
+				return WIDE;
+			}
+			return SQUARE;
+		}
+
+		/**
+		 * @return the sizes of the blocks to use for the product (m x k) * (k x n)
+		 */
+		template<typename T>
+		BlockSizes blockSizes(unsigned m, unsigned k, unsigned n) {
+			BlockSizes sizes;
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				auto tuned = this->profile.find(std::make_pair(typeName<T>(), (int) shapeOf(m, k, n)));
+				sizes = tuned != this->profile.end() ? tuned->second : defaultSizes<T>(this->caches);
+			}
+			sizes.rows = std::max(1u, std::min(sizes.rows, m));
+			sizes.depth = std::max(1u, std::min(sizes.depth, k));
+			sizes.columns = std::max(1u, std::min(sizes.columns, n));
+			//Splitting the result further, so that every worker has at least a block to compute
+			unsigned workers = ThreadPool::instance().workerCount();
+			while (Utils::ceilDiv(m, sizes.rows) * Utils::ceilDiv(n, sizes.columns) < workers) {
+				if (sizes.columns >= sizes.rows && sizes.columns >= 2 * GemmKernel<T>::NR) {
+					sizes.columns = roundUp(sizes.columns / 2, GemmKernel<T>::NR);
+				} else if (sizes.rows >= 2 * GemmKernel<T>::MR) {
+					sizes.rows = roundUp(sizes.rows / 2, GemmKernel<T>::MR);
+				} else {
+					break;
+				}
+			}
+			return sizes;
+		}
+
+		/**
+		 * Overrides the block sizes used for the given type and shape
+		 */
+		template<typename T>
+		void setBlockSizes(Shape shape, BlockSizes sizes) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->profile[std::make_pair(typeName<T>(), (int) shape)] = sizes;
+		}
+
+		/**
+		 * Forgets the tuned sizes, going back to the ones derived from the caches
+		 */
+		void clearBlockSizes() {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->profile.clear();
+		}
+
+		/**
+		 * Sets the types that use the Strassen-Winograd algorithm, and the size of the smallest product it creates: a product
+		 * is split in four while the halves of all its sizes are at least crossover.
+		 * They can also be set with the environment variables MATRIX_STRASSEN (off, exact or all) and MATRIX_STRASSEN_CROSSOVER.
+		 */
+		void setStrassen(StrassenMode mode, unsigned crossover) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->strassenMode = mode;
+			this->strassenCrossover = std::max(1u, crossover);
+		}
+
+		/**
+		 * @return the number of levels of the Strassen-Winograd recursion for the product (m x k) * (k x n), or 0 to use
+		 * the classic algorithm
+		 */
+		template<typename T>
+		unsigned strassenLevels(unsigned m, unsigned k, unsigned n) {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (this->strassenMode == STRASSEN_OFF || (this->strassenMode == STRASSEN_EXACT && !std::is_integral<T>::value) ||
+				shapeOf(m, k, n) != SQUARE) {
+				return 0;
+			}
+			unsigned levels = 0;
+			while ((std::min(m, std::min(k, n)) >> (levels + 1)) >= this->strassenCrossover) {
+				levels++;
+			}
+			return levels;
+		}
+
+		/**
+		 * Measures the product of matrices of the given shape with some block sizes around the default ones, keeping
+		 * the fastest for the type and shape of the product. The result is saved in the profile file.
+		 * @param multiply function that computes a product (m x k) * (k x n) of matrices of type T, with the current sizes
+		 * @return the chosen sizes
+		 */
+		template<typename T, class F>
+		BlockSizes autotune(unsigned m, unsigned k, unsigned n, F multiply, unsigned repetitions = 3) {
+			Shape shape = shapeOf(m, k, n);
+			BlockSizes base = defaultSizes<T>(this->caches), best = base;
+			double bestTime = -1;
+			const double factors[] = {0.5, 1, 2};
+			for (double rowFactor : factors) {
+				for (double depthFactor : factors) {
+					for (double columnFactor : factors) {
+						BlockSizes candidate;
+						candidate.rows = roundUp((unsigned) (base.rows * rowFactor), GemmKernel<T>::MR);
+						candidate.depth = std::max(8u, (unsigned) (base.depth * depthFactor));
+						candidate.columns = roundUp((unsigned) (base.columns * columnFactor), GemmKernel<T>::NR);
+						this->setBlockSizes<T>(shape, candidate);
+						double time = -1;
+						for (unsigned repetition = 0; repetition < repetitions; repetition++) {
+							auto begin = std::chrono::steady_clock::now();
+							multiply();
+							std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+							if (time < 0 || elapsed.count() < time) {
+								time = elapsed.count();
+							}
+						}
+						if (bestTime < 0 || time < bestTime) {
+							bestTime = time;
+							best = candidate;
+						}
+					}
+				}
+			}
+			this->setBlockSizes<T>(shape, best);
+			this->save(this->profilePath);
+			return best;
+		}
+
+		/**
+		 * Reads the tuned sizes from the given file. Lines have the format "type shape rows depth columns".
+		 * @return false if the file cannot be read
+		 */
+		bool load(const std::string &path) {
+			std::ifstream input(path);
+			if (!input) {
+				return false;
+			}
+			std::unique_lock<std::mutex> lock(this->mutex);
+			std::string line;
+			while (std::getline(input, line)) {
+				std::istringstream fields(line);
+				std::string type;
+				int shape;
+				BlockSizes sizes;
+				if (fields >> type >> shape >> sizes.rows >> sizes.depth >> sizes.columns &&
+					sizes.rows > 0 && sizes.depth > 0 && sizes.columns > 0) {
+					this->profile[std::make_pair(type, shape)] = sizes;
+				}
+			}
+			return true;
+		}
+
+		/**
+		 * Writes the tuned sizes to the given file
+		 * @return false if the file cannot be written
+		 */
+		bool save(const std::string &path) {
+			std::ofstream output(path);
+			if (!output) {
+				return false;
+			}
+			std::unique_lock<std::mutex> lock(this->mutex);
+			for (auto &entry : this->profile) {
+				output << entry.first.first << " " << entry.first.second << " " << entry.second.rows << " "
+					   << entry.second.depth << " " << entry.second.columns << "\n";
+			}
+			return true;
+		}
+
+		/**
+		 * @return the sizes derived from the caches, before clamping them to the operands
+		 */
+		template<typename T>
+		static BlockSizes defaultSizes(const CacheSizes &caches) {
+			BlockSizes sizes;
+			sizes.depth = std::max<unsigned>(16, (unsigned) (caches.l1 / 2 / (GemmKernel<T>::NR * sizeof(T))));
+			sizes.rows = std::max<unsigned>(GemmKernel<T>::MR,
+											(unsigned) (caches.l2 / 2 / (sizes.depth * sizeof(T))) / GemmKernel<T>::MR * GemmKernel<T>::MR);
+			//Bounding also the result block, that is read and written for every block of depth
+			std::size_t columns = std::min<std::size_t>(caches.l3 / 2 / (sizes.depth * sizeof(T)), 4 * sizes.rows);
+			sizes.columns = std::max<unsigned>(GemmKernel<T>::NR, (unsigned) columns / GemmKernel<T>::NR * GemmKernel<T>::NR);
+			return sizes;
+		}
+
+		/**
+		 * Reads the cache sizes from sysfs. When they are not available, common values are used.
+		 */
+		static CacheSizes detectCaches() {
+			CacheSizes caches = {32 * 1024, 256 * 1024, 2 * 1024 * 1024};
+			for (unsigned index = 0; index < 8; index++) {
+				std::string directory = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+				unsigned level;
+				std::string type, size, sharedCpus;
+				std::ifstream levelFile(directory + "level"), typeFile(directory + "type"), sizeFile(directory + "size");
+				if (!(levelFile >> level) || !(typeFile >> type) || !(sizeFile >> size) || type == "Instruction") {
+					continue;
+				}
+				std::size_t bytes = parseSize(size);
+				std::ifstream sharedFile(directory + "shared_cpu_list");
+				if (level == 3 && (sharedFile >> sharedCpus)) {
+					//The L3 is shared: every core gets its part
+					bytes /= std::max(1u, countCpus(sharedCpus));
+				}
+				if (bytes == 0) {
+					continue;
+				} else if (level == 1) {
+					caches.l1 = bytes;
+				} else if (level == 2) {
+					caches.l2 = bytes;
+				} else if (level == 3) {
+					caches.l3 = bytes;
+				}
+			}
+			return caches;
+		}
+
+	private:
+		template<typename T>
+		static std::string typeName() {
+			return std::to_string(sizeof(T)) + (std::is_floating_point<T>::value ? "f" : "i");
+		}
+
+		static unsigned roundUp(unsigned n, unsigned multiple) {
+			return std::max(multiple, (n + multiple - 1) / multiple * multiple);
+		}
+
+		/**
+		 * Parses sizes like "48K" or "2M"
+		 */
+		static std::size_t parseSize(const std::string &size) {
+			std::size_t value = (std::size_t) std::atol(size.c_str());
+			switch (size.empty() ? ' ' : size.back()) {
+				case 'K':
+					return value * 1024;
+				case 'M':
+					return value * 1024 * 1024;
+				case 'G':
+					return value * 1024 * 1024 * 1024;
+				default:
+					return value;
+			}
+		}
+
+		/**
+		 * Counts the CPUs in a list like "0-3,8-11"
+		 */
+		static unsigned countCpus(const std::string &list) {
+			unsigned count = 0;
+			std::istringstream ranges(list);
+			std::string range;
+			while (std::getline(ranges, range, ',')) {
+				auto dash = range.find('-');
+				if (dash == std::string::npos) {
+					count++;
+				} else {
+					count += (unsigned) (std::atoi(range.c_str() + dash + 1) - std::atoi(range.c_str()) + 1);
+				}
+			}
+			return count;
+		}
+};
+
+#endif //MATRIX_TUNING_H
@@ -0,0 +1,354 @@
+//
+// Benchmark of the multiplication.
+//
+// Every configuration (type, shape, number of threads) runs in its own process, so that the peak RSS is measured
+// separately for each of them. The results are printed as JSON, one object per line:
+//   {"type":"double","shape":"square","dims":[1024,1024,1024],"threads":4,"seconds":0.0123,"gflops":174.5,"peakRssKb":51200}
+//
+// Options:
+//   --size N          base size of the matrices (default 1024)
+//   --repetitions N   the best time of N runs is reported (default 3)
+//   --max-threads N   thread counts go from 1 to N, doubling (default: number of cores)
+//   --types LIST      comma separated subset of int,long,float,double
+//   --shapes LIST     comma separated subset of square,tall-skinny,chain
+//   --output FILE     also writes the results to FILE, to be used as a baseline later
+//   --baseline FILE   compares the results with a previous run, and fails if any is slower
+//   --tolerance X     allowed relative slowdown before flagging a regression (default 0.1)
+//   --autotune 1      instead of the benchmark, tunes the block sizes of the selected types and shapes on this host,
+//                     saving them in the tuning profile (see Tuning.h)
+//
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Matrix.h"
+
+struct Result {
+	std::string type, shape;
+	std::vector<unsigned> dims;
+	unsigned threads;
+	double seconds, gflops;
+	long peakRssKb;
+
+	std::string key() const {
+		std::ostringstream ret;
+		ret << this->type << "/" << this->shape << "/" << this->threads;
+		return ret.str();
+	}
+
+	std::string toJson() const {
+		std::ostringstream ret;
+		ret << "{\"type\":\"" << this->type << "\",\"shape\":\"" << this->shape << "\",\"dims\":[";
+		for (unsigned i = 0; i < this->dims.size(); i++) {
+			ret << (i > 0 ? "," : "") << this->dims[i];
+		}
+		ret << "],\"threads\":" << this->threads << ",\"seconds\":" << this->seconds << ",\"gflops\":" << this->gflops
+			<< ",\"peakRssKb\":" << this->peakRssKb << "}";
+		return ret.str();
+	}
+
+	/**
+	 * Parses a line written by toJson(). Only the fields used by the comparison are read.
+	 */
+	static bool fromJson(const std::string &line, Result &result) {
+		result.type = stringField(line, "type");
+		result.shape = stringField(line, "shape");
+		result.threads = (unsigned) numberField(line, "threads");
+		result.seconds = numberField(line, "seconds");
+		result.gflops = numberField(line, "gflops");
+		return !result.type.empty() && !result.shape.empty();
+	}
+
+	private:
+		static std::string stringField(const std::string &line, const std::string &name) {
+			std::string pattern = "\"" + name + "\":\"";
+			auto start = line.find(pattern);
+			if (start == std::string::npos) {
+				return "";
+			}
+			start += pattern.size();
+			return line.substr(start, line.find('"', start) - start);
+		}
+
+		static double numberField(const std::string &line, const std::string &name) {
+			std::string pattern = "\"" + name + "\":";
+			auto start = line.find(pattern);
+			return start == std::string::npos ? 0 : std::atof(line.c_str() + start + pattern.size());
+		}
+};
+
+/**
+ * @return the dimensions of the matrices of the given shape: matrix i is dims[i] x dims[i+1]
+ */
+std::vector<unsigned> shapeDimensions(const std::string &shape, unsigned size) {
+	if (shape == "square") {
+		return {size, size, size};
+	} else if (shape == "tall-skinny") {
+		return {16 * size, std::max(1u, size / 8), std::max(1u, size / 8)};
+	} else if (shape == "chain") {
+		return {size, std::max(1u, size / 16), size, std::max(1u, size / 4), std::max(1u, size / 2)};
+	}
+	Utils::error("Unknown shape " + shape);
+	return {};
+}
+
+/**
+ * @return the number of floating point operations of the best order of the chain
+ */
+double chainFlops(const std::vector<unsigned> &dims) {
+	unsigned n = (unsigned) dims.size() - 1;
+	std::vector<std::vector<double>> cost(n, std::vector<double>(n, 0));
+	for (unsigned length = 2; length <= n; length++) {
+		for (unsigned i = 0; i + length <= n; i++) {
+			unsigned j = i + length - 1;
+			cost[i][j] = -1;
+			for (unsigned k = i; k < j; k++) {
+				double c = cost[i][k] + cost[k + 1][j] + 2.0 * dims[i] * dims[k + 1] * dims[j + 1];
+				if (cost[i][j] < 0 || c < cost[i][j]) {
+					cost[i][j] = c;
+				}
+			}
+		}
+	}
+	return cost[0][n - 1];
+}
+
+template<typename T>
+Matrix<T> createMatrix(unsigned rows, unsigned columns, unsigned seed) {
+	Matrix<T> m(rows, columns);
+	for (unsigned r = 0; r < rows; r++) {
+		for (unsigned c = 0; c < columns; c++) {
+			m(r, c) = (T) ((r * 7 + c * 3 + seed) % 11);
+		}
+	}
+	return m;
+}
+
+/**
+ * Runs the product of the chain of matrices, returning the best time
+ */
+template<typename T>
+double runChain(const std::vector<unsigned> &dims, unsigned repetitions) {
+	std::vector<Matrix<T>> matrices;
+	for (unsigned i = 0; i + 1 < dims.size(); i++) {
+		matrices.push_back(createMatrix<T>(dims[i], dims[i + 1], i));
+	}
+	double best = -1;
+	for (unsigned repetition = 0; repetition < repetitions; repetition++) {
+		auto begin = std::chrono::steady_clock::now();
+		T first;
+		if (matrices.size() == 2) {
+			first = (matrices[0] * matrices[1]).copy()(0, 0);
+		} else {
+			first = (matrices[0] * matrices[1] * matrices[2] * matrices[3]).copy()(0, 0);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+		//Using the result, so that the product cannot be skipped
+		if (first == (T) -1) {
+			std::cerr << "Unexpected result" << std::endl;
+		}
+		if (best < 0 || elapsed.count() < best) {
+			best = elapsed.count();
+		}
+	}
+	return best;
+}
+
+double runConfiguration(const std::string &type, const std::vector<unsigned> &dims, unsigned repetitions) {
+	if (dims.size() != 3 && dims.size() != 5) {
+		Utils::error("Only products of two or four matrices are supported");
+	}
+	if (type == "int") {
+		return runChain<int>(dims, repetitions);
+	} else if (type == "long") {
+		return runChain<long>(dims, repetitions);
+	} else if (type == "float") {
+		return runChain<float>(dims, repetitions);
+	} else if (type == "double") {
+		return runChain<double>(dims, repetitions);
+	}
+	Utils::error("Unknown type " + type);
+	return 0;
+}
+
+/**
+ * Runs a configuration in a child process, and reads its result from a pipe
+ */
+bool measure(const std::string &type, const std::string &shape, unsigned size, unsigned threads, unsigned repetitions,
+			 Result &result) {
+	result.type = type;
+	result.shape = shape;
+	result.dims = shapeDimensions(shape, size);
+	result.threads = threads;
+	int channel[2];
+	if (pipe(channel) != 0) {
+		return false;
+	}
+	pid_t child = fork();
+	if (child == 0) {
+		close(channel[0]);
+		//The parent never uses the pool, so it's created here for the first time, directly with the right number of workers
+		setenv("MATRIX_THREADS", std::to_string(threads).c_str(), 1);
+		ThreadPool::instance();
+		double seconds = runConfiguration(type, result.dims, repetitions);
+		if (write(channel[1], &seconds, sizeof(seconds)) != sizeof(seconds)) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	close(channel[1]);
+	double seconds = -1;
+	bool ok = child > 0 && read(channel[0], &seconds, sizeof(seconds)) == sizeof(seconds);
+	close(channel[0]);
+	int status;
+	struct rusage usage;
+	if (child <= 0 || wait4(child, &status, 0, &usage) != child || !ok) {
+		return false;
+	}
+	result.seconds = seconds;
+	result.gflops = chainFlops(result.dims) / seconds / 1e9;
+	result.peakRssKb = usage.ru_maxrss;
+	return true;
+}
+
+/**
+ * Tunes the block sizes of the given shapes, in this process
+ */
+template<typename T>
+void autotune(const std::string &type, const std::vector<std::string> &shapes, unsigned size, unsigned repetitions) {
+	for (auto &shape : shapes) {
+		auto dims = shapeDimensions(shape, size);
+		auto left = createMatrix<T>(dims[0], dims[1], 0);
+		auto right = createMatrix<T>(dims[1], dims[2], 1);
+		BlockSizes best = Tuning::instance().autotune<T>(dims[0], dims[1], dims[2], [&] {
+			(left * right).copy();
+		}, repetitions);
+		std::cout << type << " " << shape << ": blocks of " << best.rows << "x" << best.depth << " and " << best.depth
+				  << "x" << best.columns << std::endl;
+	}
+}
+
+std::vector<std::string> split(const std::string &list) {
+	std::vector<std::string> ret;
+	std::istringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		ret.push_back(item);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	unsigned size = 1024, repetitions = 3;
+	unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::string> types = {"int", "long", "float", "double"};
+	std::vector<std::string> shapes = {"square", "tall-skinny", "chain"};
+	std::string outputPath, baselinePath;
+	double tolerance = 0.1;
+	bool tune = false;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i], value = argv[i + 1];
+		if (option == "--size") {
+			size = (unsigned) std::atoi(value.c_str());
+		} else if (option == "--repetitions") {
+			repetitions = std::max(1, std::atoi(value.c_str()));
+		} else if (option == "--max-threads") {
+			maxThreads = std::max(1, std::atoi(value.c_str()));
+		} else if (option == "--types") {
+			types = split(value);
+		} else if (option == "--shapes") {
+			shapes = split(value);
+		} else if (option == "--output") {
+			outputPath = value;
+		} else if (option == "--baseline") {
+			baselinePath = value;
+		} else if (option == "--tolerance") {
+			tolerance = std::atof(value.c_str());
+		} else if (option == "--autotune") {
+			tune = std::atoi(value.c_str()) != 0;
+		} else {
+			std::cerr << "Unknown option " << option << std::endl;
+			return 2;
+		}
+	}
+
+	if (tune) {
+		//Chains are made of products of the other shapes
+		shapes.erase(std::remove(shapes.begin(), shapes.end(), "chain"), shapes.end());
+		for (auto &type : types) {
+			if (type == "int") {
+				autotune<int>(type, shapes, size, repetitions);
+			} else if (type == "long") {
+				autotune<long>(type, shapes, size, repetitions);
+			} else if (type == "float") {
+				autotune<float>(type, shapes, size, repetitions);
+			} else if (type == "double") {
+				autotune<double>(type, shapes, size, repetitions);
+			}
+		}
+		return 0;
+	}
+
+	std::map<std::string, Result> baseline;
+	if (!baselinePath.empty()) {
+		std::ifstream input(baselinePath);
+		std::string line;
+		while (std::getline(input, line)) {
+			Result result;
+			if (Result::fromJson(line, result)) {
+				baseline[result.key()] = result;
+			}
+		}
+		if (baseline.empty()) {
+			std::cerr << "The baseline " << baselinePath << " has no results" << std::endl;
+			return 2;
+		}
+	}
+
+	std::ofstream output;
+	if (!outputPath.empty()) {
+		output.open(outputPath);
+	}
+	std::vector<unsigned> threadCounts;
+	for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	unsigned regressions = 0;
+	for (auto &type : types) {
+		for (auto &shape : shapes) {
+			for (unsigned threads : threadCounts) {
+				Result result;
+				if (!measure(type, shape, size, threads, repetitions, result)) {
+					std::cerr << "Failed: " << type << " " << shape << " with " << threads << " threads" << std::endl;
+					return 1;
+				}
+				std::cout << result.toJson() << std::endl;
+				if (output.is_open()) {
+					output << result.toJson() << std::endl;
+				}
+				auto previous = baseline.find(result.key());
+				if (previous != baseline.end() && result.gflops < previous->second.gflops * (1 - tolerance)) {
+					std::cerr << "REGRESSION " << result.key() << ": " << result.gflops << " GFLOP/s, was "
+							  << previous->second.gflops << std::endl;
+					regressions++;
+				}
+			}
+		}
+	}
+	if (!baseline.empty()) {
+		std::cerr << regressions << " regressions" << std::endl;
+	}
+	return regressions > 0 ? 1 : 0;
+}
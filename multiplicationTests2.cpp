@@ -2,6 +2,8 @@
 #include <vector>
 #include <ctime>
 #include <memory>
+#include <fstream>
+#include <cstdlib>
 #include "Matrix.h"
 #include "StaticSizeMatrix.h"
 
@@ -56,6 +58,11 @@ int main() {
 	auto multiplication = ((mA + mB) * (mC + mD) * (mE + mF)) + (mG * mH);
 
 
+	//Set MATRIX_PROFILE to print the profile of the evaluation, and to save it as a Chrome trace
+	bool profile = std::getenv("MATRIX_PROFILE") != NULL;
+	if (profile) {
+		Profiler::start();
+	}
 	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 	long first = multiplication(0, 0);
 	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
@@ -63,7 +70,13 @@ int main() {
 
 	std::cout << "((A + B) * (C + D) * (E + F)) + (G * H)" << std::endl;
 	std::cout << std::endl << std::endl;
-	//multiplication.getData().printTree();
+	if (profile) {
+		Profiler::stop();
+		std::cout << Profiler::toText();
+		std::ofstream("profile.json") << Profiler::toChromeTrace();
+		std::ofstream("profile.dot") << Profiler::toDot();
+		std::cout << "Saved profile.json and profile.dot" << std::endl;
+	}
 	std::cout << std::endl << std::endl;
 	std::cout << "Oks" << std::endl;
 
@@ -1,8 +1,11 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <numeric>
+#include <thread>
 #include "Matrix.h"
 #include "StaticSizeMatrix.h"
+#include "FileMatrixData.h"
 
 template<typename T, class MD>
 void initializeCells(Matrix<T, MD> &m, T rowMultiplier, T colMultiplier) {
@@ -216,6 +219,681 @@ void testMultiplicationAndAddition() {
 }
 
 
+template<typename T>
+void testBlockedMultiplication(unsigned rows, unsigned inner, unsigned columns) {
+	Matrix<T> a(rows, inner);
+	Matrix<T> b(inner, columns);
+	initializeCells<T>(a, 3, 1);
+	initializeCells<T>(b, 1, 2);
+	auto product = a * b;
+	for (unsigned r = 0; r < rows; r += 7) {
+		for (unsigned c = 0; c < columns; c += 5) {
+			T expected = 0;
+			for (unsigned k = 0; k < inner; k++) {
+				expected += a(r, k) * b(k, c);
+			}
+			assert<T>(expected, product(r, c));
+		}
+	}
+}
+
+void testBufferPool() {
+	assert<std::size_t>(256, BufferPool::sizeClass(1));
+	assert<std::size_t>(5120, BufferPool::sizeClass(4097));
+	assert<std::size_t>(4096, BufferPool::sizeClass(4096));
+	void *buffer = BufferPool::instance().allocate(1000);
+	assert<std::size_t>(0, reinterpret_cast<std::uintptr_t>(buffer) % BufferPool::ALIGNMENT);
+	BufferPool::instance().deallocate(buffer, 1000);
+	//A request of the same class reuses the cached buffer
+	void *reused = BufferPool::instance().allocate(1020);
+	assert<bool>(true, buffer == reused);
+	BufferPool::instance().deallocate(reused, 1020);
+
+	auto m = VectorMatrixData<double>::uninitialized(33, 17);
+	assert<std::size_t>(0, reinterpret_cast<std::uintptr_t>(m.strided().data) % BufferPool::ALIGNMENT);
+	VectorMatrixData<long> zeros(20, 30);
+	for (unsigned r = 0; r < zeros.rows(); r++) {
+		for (unsigned c = 0; c < zeros.columns(); c++) {
+			assert<long>(0, zeros.get(r, c));
+		}
+	}
+}
+
+void testFileMatrix() {
+	//Tiles of 16x16 ints, and a cache of only 4 tiles
+	auto file = Matrix<int, FileMatrixData<int>>::fromData(FileMatrixData<int>::temporary(70, 90, 16, 4 * 16 * 16 * sizeof(int)));
+	Matrix<int> memory(70, 90);
+	initializeCells<int>(memory, 3, 1);
+	for (unsigned r = 0; r < memory.rows(); r++) {
+		for (unsigned c = 0; c < memory.columns(); c++) {
+			file(r, c) = memory(r, c);
+		}
+	}
+	assertEquals(memory, file);
+	assertEquals(memory.transpose(), file.transpose().copy());
+	//The tiles of the file are streamed into the packed blocks
+	Matrix<int> right(90, 40);
+	initializeCells<int>(right, 1, 2);
+	assertEquals((memory * right).copy(), (file * right).copy());
+
+	//Product computed one tile at a time, directly into another file
+	auto product = FileMatrixData<int>::temporary(70, 40, 16, 4 * 16 * 16 * sizeof(int));
+	product.assignProduct(file.getData(), right.getData());
+	assertEquals((memory * right).copy(), Matrix<int, FileMatrixData<int>>::fromData(product));
+}
+
+void testTuning() {
+	assert<int>(Tuning::SQUARE, Tuning::shapeOf(100, 100, 100));
+	assert<int>(Tuning::TALL, Tuning::shapeOf(1000, 100, 100));
+	assert<int>(Tuning::WIDE, Tuning::shapeOf(100, 100, 1000));
+	assert<int>(Tuning::SHALLOW, Tuning::shapeOf(1000, 10, 1000));
+	CacheSizes caches = {32 * 1024, 256 * 1024, 2 * 1024 * 1024};
+	BlockSizes sizes = Tuning::defaultSizes<double>(caches);
+	assert<bool>(true, sizes.depth * GemmKernel<double>::NR * sizeof(double) <= caches.l1);
+	assert<bool>(true, sizes.rows * sizes.depth * sizeof(double) <= caches.l2);
+	assert<unsigned>(0, sizes.rows % GemmKernel<double>::MR);
+	assert<unsigned>(0, sizes.columns % GemmKernel<double>::NR);
+	//Small rectangular blocks, that don't divide the matrices
+	Tuning::instance().setBlockSizes<long>(Tuning::SQUARE, {7, 5, 9});
+	testBlockedMultiplication<long>(40, 33, 29);
+	Tuning::instance().clearBlockSizes();
+}
+
+void testProfiler() {
+	Matrix<int> a(40, 30);
+	Matrix<int> b(30, 20);
+	initializeCells<int>(a, 1, 2);
+	initializeCells<int>(b, 3, 1);
+	Profiler::start();
+	((a + a) * b).copy();
+	Profiler::stop();
+	std::string text = Profiler::toText();
+	assert<bool>(true, text.find("MultiplyMD") != std::string::npos);
+	assert<bool>(true, text.find("SumMDa") != std::string::npos);
+	assert<bool>(true, text.find(std::to_string(2 * 40 * 30 * 20) + " flops") != std::string::npos);
+	assert<bool>(true, Profiler::toDot().find("->") != std::string::npos);
+	assert<bool>(true, Profiler::toChromeTrace().find("\"ph\":\"X\"") != std::string::npos);
+}
+
+void testFusedPacking() {
+	Matrix<int> a(150, 260);
+	Matrix<int> b(150, 260);
+	Matrix<int> c(190, 260);
+	initializeCells<int>(a, 3, 1);
+	initializeCells<int>(b, 1, 2);
+	initializeCells<int>(c, 2, 5);
+	//The sum and the transposition are evaluated while packing the blocks
+	auto product = (a + b) * c.transpose().submatrix(0, 3, 260, 187);
+	for (unsigned r = 0; r < product.rows(); r += 3) {
+		for (unsigned col = 0; col < product.columns(); col += 4) {
+			int expected = 0;
+			for (unsigned k = 0; k < 260; k++) {
+				expected += (a(r, k) + b(r, k)) * c(col + 3, k);
+			}
+			assert<int>(expected, product(r, col));
+		}
+	}
+}
+
+void testStaticMultiplication() {
+	StaticSizeMatrix<4, 9, int> a;
+	StaticSizeMatrix<7, 9, int> b;
+	StaticSizeMatrix<4, 9, int> c;
+	initializeCells<int>(a, 3, 1);
+	initializeCells<int>(b, 2, -1);
+	initializeCells<int>(c, 1, 5);
+	//Small products are computed inline, the sum and the transposition with the static kernels
+	auto product = (a + c) * b.transpose();
+	static_assert(StaticProduct<int, 4, 9, 7, VectorMatrixData<int>, VectorMatrixData<int>>::IS_SMALL, "4x9 * 9x7 should be small");
+	static_assert(!StaticProduct<int, 20, 20, 20, VectorMatrixData<int>, VectorMatrixData<int>>::IS_SMALL, "20x20 * 20x20 should not be small");
+	auto chained = product * b.submatrix<0, 2, 7, 3>();
+	for (unsigned r = 0; r < 4; r++) {
+		for (unsigned col = 0; col < 7; col++) {
+			int expected = 0;
+			for (unsigned k = 0; k < 9; k++) {
+				expected += (a(r, k) + c(r, k)) * b(col, k);
+			}
+			assert<int>(expected, product(r, col));
+		}
+		for (unsigned col = 0; col < 3; col++) {
+			int expected = 0;
+			for (unsigned k = 0; k < 7; k++) {
+				expected += product(r, k) * b(k, col + 2);
+			}
+			assert<int>(expected, chained(r, col));
+		}
+	}
+}
+
+void testStaticChain() {
+	StaticSizeMatrix<2, 3, int> a;
+	StaticSizeMatrix<3, 5, int> b;
+	StaticSizeMatrix<5, 2, int> c;
+	initializeCells<int>(a, 1, 2);
+	initializeCells<int>(b, -2, 1);
+	initializeCells<int>(c, 3, 4);
+	auto product = a * b * c;
+	//(3x5)*(5x2) is computed first, and the tree is a type
+	typedef StaticMultiplyMD<int, 3, 5, 2, VectorMatrixData<int>, VectorMatrixData<int>> Right;
+	typedef StaticMultiplyMD<int, 2, 3, 2, VectorMatrixData<int>, Right> Root;
+	static_assert(ChainOrder<Dimensions<2, 3, 5, 2>>::PLAN.split[0][2] == 0, "Wrong order of the chain");
+	typedef StaticChainMD<int, Dimensions<2, 3, 5, 2>, VectorMatrixData<int>, VectorMatrixData<int>, VectorMatrixData<int>> Chain;
+	static_assert(std::is_same<std::remove_const<decltype(product)>::type, StaticSizeMatrix<2, 2, int, Chain>>::value, "The chain should be flat");
+	static_assert(std::is_same<Chain::Tree::type, Root>::value, "Wrong tree of the chain");
+	//Large products keep their place in the tree
+	typedef Dimensions<300, 10, 20, 10> Dims;
+	typedef std::tuple<VectorMatrixData<int>, VectorMatrixData<int>, VectorMatrixData<int>> Operands;
+	static_assert(std::is_same<StaticChainNode<int, Dims, Operands, 0, 2>::type,
+			FixedOrderMultiplyMD<int, VectorMatrixData<int>, StaticMultiplyMD<int, 10, 20, 10, VectorMatrixData<int>, VectorMatrixData<int>>>>::value,
+				  "Wrong tree of the large chain");
+	for (unsigned r = 0; r < 2; r++) {
+		for (unsigned col = 0; col < 2; col++) {
+			int expected = 0;
+			for (unsigned i = 0; i < 3; i++) {
+				for (unsigned j = 0; j < 5; j++) {
+					expected += a(r, i) * b(i, j) * c(j, col);
+				}
+			}
+			assert<int>(expected, product(r, col));
+		}
+	}
+	assertEquals(product, (a * b) * c.copy());
+}
+
+template<typename T>
+void testSparse(typename SparseMatrixData<T>::Format format) {
+	//About 5% of the cells are nonzero, and some of them are repeated
+	std::vector<Triplet<T>> triplets;
+	for (unsigned i = 0; i < 1500; i++) {
+		triplets.push_back({(i * 37) % 200, (i * 53) % 150, (T) (i % 7 + 1)});
+	}
+	triplets.push_back({5, 9, (T) 3});
+	triplets.push_back({5, 9, (T) 4});
+	auto sparse = Matrix<T, SparseMatrixData<T>>::fromData(SparseMatrixData<T>::fromTriplets(200, 150, triplets, format));
+	auto dense = sparse.copy();
+	assert<T>(7, sparse(5, 9));
+	assert<T>(0, sparse(5, 10));
+	assertEquals(dense, sparse);
+
+	Matrix<T> right(150, 70), left(90, 200), vector(150, 1), covector(1, 200);
+	initializeCells<T>(right, 1, 2);
+	initializeCells<T>(left, 2, 1);
+	initializeCells<T>(vector, 3, 0);
+	initializeCells<T>(covector, 0, 1);
+	//Sparse-dense, dense-sparse, sparse matrix-vector and vector-matrix products
+	assertEquals(dense * right, (sparse * right).copy());
+	assertEquals(left * dense, (left * sparse).copy());
+	assertEquals(dense * vector, (sparse * vector).copy());
+	assertEquals(covector * dense, (covector * sparse).copy());
+	//A dense operand without a strided layout is materialized once
+	assertEquals(dense * (right + right), (sparse * (right + right)).copy());
+}
+
+void testStrassen() {
+	Matrix<long> a(203, 190);
+	Matrix<long> b(190, 211);
+	initializeCells<long>(a, 3, -7);
+	initializeCells<long>(b, 5, 2);
+	Tuning &tuning = Tuning::instance();
+	tuning.setStrassen(Tuning::STRASSEN_OFF, 32);
+	auto classic = (a * b).copy();
+	//Two levels of recursion, with odd sizes that are padded
+	tuning.setStrassen(Tuning::STRASSEN_EXACT, 32);
+	assert(2u, tuning.strassenLevels<long>(203, 190, 211));
+	assert(0u, tuning.strassenLevels<double>(203, 190, 211));
+	assertEquals(classic, (a * b).copy());
+	//Floating point types are opt-in
+	tuning.setStrassen(Tuning::STRASSEN_ALL, 32);
+	auto strassen = (a.cast<double>() * b.cast<double>()).copy();
+	for (unsigned r = 0; r < classic.rows(); r++) {
+		for (unsigned c = 0; c < classic.columns(); c++) {
+			assert<bool>(true, std::abs(strassen(r, c) - classic(r, c)) <= 1e-9 * std::abs((double) classic(r, c)) + 1e-6);
+		}
+	}
+	tuning.setStrassen(Tuning::STRASSEN_EXACT, 2048);
+}
+
+void testCopyOnWrite() {
+	Matrix<int> m(40, 30);
+	initializeCells<int>(m, 3, -7);
+	auto view = m.submatrix(1, 2, 10, 10);
+	Matrix<int> copy(m);
+	//The copy shares the memory until one of the two is written
+	assert(m.strided().data, copy.strided().data);
+	assert(true, m.getData().isShared());
+	m(1, 2) = 12345;
+	assert<bool>(true, m.strided().data != copy.strided().data);
+	assert(false, m.getData().isShared());
+	assert(false, copy.getData().isShared());
+	//The views over the written matrix see the write, the copy doesn't
+	assert(12345, (int) view(0, 0));
+	assert<bool>(true, copy(1, 2) != 12345);
+	copy(0, 0) = 7;
+	assert<bool>(true, m(0, 0) != 7);
+	//Writing the memory directly clones it as well
+	Matrix<int> other(copy);
+	StridedData<int> memory = other.writableStrided();
+	assert<bool>(true, memory.data != copy.strided().data);
+	memory.data[0] = 8;
+	assert(8, (int) other(0, 0));
+	assert(7, (int) copy(0, 0));
+}
+
+void testSpans() {
+	Matrix<long> a(70, 45);
+	Matrix<long> b(45, 33);
+	initializeCells<long>(a, 3, -7);
+	initializeCells<long>(b, 5, 2);
+	auto product = a * b;
+	auto expected = product.copy();
+	//Rows of a matrix in memory, of a transposed one and of a lazy product
+	long sum = std::accumulate(expected.begin(), expected.end(), 0L);
+	unsigned rows = 0;
+	for (auto span : product.rowSpans()) {
+		assert(rows++, span.row());
+		assert(expected.columns(), span.size());
+		for (unsigned c = 0; c < span.size(); c++) {
+			assert<long>(expected(span.row(), c), span[c]);
+		}
+		sum -= std::accumulate(span.begin(), span.end(), 0L);
+	}
+	assert(expected.rows(), rows);
+	assert(0L, sum);
+	auto transposed = a.transpose();
+	for (auto span : transposed.rowSpans()) {
+		assert<long>(a(span.col(), span.row()), span[0]);
+	}
+	assert<const long *>(a.strided().data, (*a.rowSpans().begin()).data());
+	//Tiles, with smaller tiles on the edges
+	unsigned cells = 0;
+	for (auto tile : product.tiles(16, 10)) {
+		for (unsigned r = 0; r < tile.rows(); r++) {
+			for (unsigned c = 0; c < tile.columns(); c++) {
+				assert<long>(expected(tile.rowOffset() + r, tile.colOffset() + c), tile(r, c));
+			}
+		}
+		cells += tile.rows() * tile.columns();
+	}
+	assert(expected.size(), cells);
+	assert(5u * 4u, product.tiles(16, 10).size());
+	std::atomic<long> parallelSum(0);
+	(a * b + expected).forEachTile([&parallelSum](const MatrixTile<long> &tile) {
+		long tileSum = 0;
+		for (unsigned r = 0; r < tile.rows(); r++) {
+			tileSum = std::accumulate(tile.row(r).begin(), tile.row(r).end(), tileSum);
+		}
+		parallelSum += tileSum;
+	}, 8, 8);
+	assert(2 * std::accumulate(expected.begin(), expected.end(), 0L), parallelSum.load());
+}
+
+void testParallelMaterialization() {
+	Matrix<int> a(700, 300);
+	Matrix<int> b(300, 700);
+	initializeCells<int>(a, 3, -7);
+	initializeCells<int>(b, 5, 2);
+	//Divided in strips of rows
+	auto sum = (a + b.transpose() + a).copy();
+	for (unsigned r = 0; r < a.rows(); r++) {
+		for (unsigned c = 0; c < a.columns(); c++) {
+			assert<int>(2 * a(r, c) + b(c, r), sum(r, c));
+		}
+	}
+	//Divided in strips of columns: a single row is too short to be divided in strips of rows
+	Matrix<int> wide(1, 200000);
+	initializeCells<int>(wide, 1, 3);
+	auto cast = wide.transpose().transpose().cast<long>().copy();
+	for (unsigned c = 0; c < wide.columns(); c++) {
+		assert<long>(wide(0, c), cast(0, c));
+	}
+}
+
+void testAssign() {
+	Matrix<long> a(60, 60);
+	Matrix<long> b(60, 60);
+	initializeCells<long>(a, 3, -7);
+	initializeCells<long>(b, 5, 2);
+	const long *memory = a.strided().data;
+	//Elementwise, in place
+	auto expected = (a + b + a).copy();
+	a.assign(a + b + a);
+	assert(memory, (const long *) a.strided().data);
+	assertEquals(expected, a);
+	//The product reads the memory that is written, through a temporary
+	auto product = (a * b).copy();
+	a.assign(a * b);
+	assert(memory, (const long *) a.strided().data);
+	assertEquals(product, a);
+	//Reading the transposed of the same memory is not elementwise
+	auto transposed = a.transpose().copy();
+	a.assign(a.transpose());
+	assertEquals(transposed, a);
+	//Views as destinations
+	Matrix<long> c(60, 60);
+	c.submatrix(10, 20, 30, 40).assign(b.submatrix(0, 0, 30, 40) + b.submatrix(30, 20, 30, 40));
+	c.transpose().submatrix(0, 0, 5, 5).assign(b.submatrix(0, 0, 5, 5));
+	for (unsigned r = 0; r < 30; r++) {
+		for (unsigned col = 0; col < 40; col++) {
+			assert<long>(b(r, col) + b(r + 30, col + 20), c(r + 10, col + 20));
+		}
+	}
+	for (unsigned r = 0; r < 5; r++) {
+		for (unsigned col = 0; col < 5; col++) {
+			assert<long>(b(r, col), c(col, r));
+		}
+	}
+	//Overlapping regions of the same matrix
+	Matrix<long> d(b);
+	d.submatrix(1, 0, 59, 60).assign(d.submatrix(0, 0, 59, 60));
+	for (unsigned col = 0; col < 60; col++) {
+		assert<long>(b(0, col), d(1, col));
+		assert<long>(b(58, col), d(59, col));
+	}
+	//The matrix that was copied doesn't see the assignment
+	assert<bool>(true, b(1, 0) != d(1, 0));
+}
+
+void testElementwise() {
+	Matrix<long> a(150, 300);
+	Matrix<long> b(150, 300);
+	Matrix<long> c(300, 150);
+	initializeCells<long>(a, 3, -7);
+	initializeCells<long>(b, 5, 2);
+	initializeCells<long>(c, -1, 4);
+	//A whole expression evaluated in a single pass, with a transposed operand and a product
+	auto product = a * c;
+	auto expression = (2 * a - b.hadamard(c.transpose()) + -b * 3).map([](long x) { return x / 2; }).copy();
+	auto sum = Matrix<long>::sumOf({a, b, a}).copy();
+	auto difference = (a.submatrix(0, 0, 150, 150) - product).zip(product, [](long x, long y) { return x * y; }).copy();
+	for (unsigned r = 0; r < a.rows(); r++) {
+		for (unsigned col = 0; col < a.columns(); col++) {
+			assert<long>((2 * a(r, col) - b(r, col) * c(col, r) - 3 * b(r, col)) / 2, expression(r, col));
+			assert<long>(2 * a(r, col) + b(r, col), sum(r, col));
+		}
+		for (unsigned col = 0; col < product.columns(); col++) {
+			assert<long>((a(r, col) - product(r, col)) * product(r, col), difference(r, col));
+		}
+	}
+	assert<long>(-2 * a(3, 4), (a * -2)(3, 4));
+	//Static sizes are kept
+	StaticSizeMatrix<2, 3, int> mA;
+	StaticSizeMatrix<2, 3, int> mD;
+	mA(1, 2) = 4;
+	mD(1, 2) = 1;
+	StaticSizeMatrix<2, 3, int, VectorMatrixData<int>> result = (2 * mA - mD.hadamard(mD)).copy();
+	assert(7, (int) result(1, 2));
+	//In place, through a transposed destination
+	Matrix<double> d(64, 64);
+	initializeCells<double>(d, 1, 0.5);
+	auto expected = (d.transpose() * 0.5 + d.transpose()).copy();
+	d.transpose().assign(d.transpose() * 0.5 + d.transpose());
+	assertEquals(expected, d.transpose());
+}
+
+void testCommonSubexpressions() {
+	Matrix<int> a(40, 30);
+	Matrix<int> b(30, 20);
+	initializeCells<int>(a, 1, 2);
+	initializeCells<int>(b, 3, 1);
+	auto cell = [&a, &b](unsigned r, unsigned c) {
+		int sum = 0;
+		for (unsigned k = 0; k < a.columns(); k++) {
+			sum += a(r, k) * b(k, c);
+		}
+		return sum;
+	};
+	//Counting the products computed since the profiler was started, from the flops of their blocks
+	auto countProducts = [] {
+		std::string text = Profiler::toText(), flops = " " + std::to_string(2 * 40 * 30 * 20) + " flops";
+		int count = 0;
+		for (std::size_t i = text.find(flops); i != std::string::npos; i = text.find(flops, i + 1)) {
+			count++;
+		}
+		return count;
+	};
+	Profiler::start();
+	auto twice = (a * b + a * b).copy();
+	Profiler::stop();
+	assert<int>(1, countProducts());
+	assert<int>(2 * cell(7, 3), twice(7, 3));
+	//The result is shared with the next expressions, as long as it's used
+	const auto product = a * b;
+	assert<int>(cell(5, 7), product(5, 7));
+	Profiler::start();
+	auto same = (a * b).copy();
+	Profiler::stop();
+	assert<int>(0, countProducts());
+	assert<int>(cell(5, 7), same(5, 7));
+	//Writing an operand changes its fingerprint
+	int before = product(0, 3);
+	a(0, 0) = 100;
+	Profiler::start();
+	auto changed = (a * b).copy();
+	Profiler::stop();
+	assert<int>(1, countProducts());
+	assert<int>(cell(0, 3), changed(0, 3));
+	assert<int>(before, product(0, 3));
+	assert<bool>(true, before != changed(0, 3));
+}
+
+void testReductions() {
+	Matrix<long> a(700, 300);
+	Matrix<long> b(300, 200);
+	initializeCells<long>(a, 3, -7);
+	initializeCells<long>(b, -2, 5);
+	a(123, 45) = -100000;
+	a(600, 7) = 100000;
+	a(650, 8) = 100000;
+	//Expected values, computed cell by cell
+	auto product = (a * b).copy();
+	long sum = 0, squares = 0, dot = 0, norm1 = 0, normInf = 0;
+	std::vector<long> columnSums(product.columns(), 0);
+	for (unsigned r = 0; r < product.rows(); r++) {
+		long rowSum = 0;
+		for (unsigned c = 0; c < product.columns(); c++) {
+			long value = product(r, c);
+			sum += value;
+			columnSums[c] += std::abs(value);
+			rowSum += std::abs(value);
+		}
+		normInf = std::max(normInf, rowSum);
+	}
+	norm1 = *std::max_element(columnSums.begin(), columnSums.end());
+	for (unsigned r = 0; r < a.rows(); r++) {
+		for (unsigned c = 0; c < a.columns(); c++) {
+			squares += a(r, c) * a(r, c);
+			dot += a(r, c) * a(r, c) * 2;
+		}
+	}
+	//Over a lazy product, a view and an elementwise expression
+	assert<long>(sum, (a * b).sum());
+	assert<long>(norm1, (a * b).norm1());
+	assert<long>(normInf, (a * b).normInf());
+	assert<long>(sum, (a * b).transpose().sum());
+	assert<long>(normInf, (a * b).transpose().norm1());
+	assert<long>((long) std::sqrt(squares), a.frobeniusNorm());
+	assert<long>(dot, a.dot(a + a));
+	assert<long>(dot, a.transpose().dot((a * 2).transpose()));
+	assert<long>(-100000, a.min());
+	assert<long>(100000, a.max());
+	assert<bool>(true, std::make_pair(123u, 45u) == a.argmin());
+	assert<bool>(true, std::make_pair(600u, 7u) == a.argmax());
+	assert<bool>(true, std::make_pair(7u, 600u) == a.transpose().argmax());
+	long trace = 0;
+	for (unsigned i = 0; i < 300; i++) {
+		trace += a(i, i);
+	}
+	assert<long>(trace, a.submatrix(0, 0, 300, 300).trace());
+	//Vectors, stored by rows or by columns
+	Matrix<double> v(100000, 1);
+	initializeCells<double>(v, 0.5, 1);
+	double expected = 0;
+	for (unsigned i = 0; i < v.rows(); i++) {
+		expected += v(i, 0) * v(i, 0);
+	}
+	assert<bool>(true, std::abs(expected - v.dot(v)) <= 1e-9 * expected);
+	assert<bool>(true, std::abs(expected - v.transpose().dot(v.transpose())) <= 1e-9 * expected);
+	assert<bool>(true, std::abs(std::sqrt(expected) - v.frobeniusNorm()) <= 1e-9 * std::sqrt(expected));
+	assert<double>(0, Matrix<double>(0, 5).sum());
+	//Short and wide, reduced in strips of columns: the maximum is in two strips, and the first one is reported
+	Matrix<long> wide(1, 200000);
+	long wideSum = 0, wideDot = 0;
+	for (unsigned c = 0; c < wide.columns(); c++) {
+		wide(0, c) = (long) (c * 7 % 1000) - 500;
+	}
+	wide(0, 100000) = 5000;
+	wide(0, 150000) = 5000;
+	for (unsigned c = 0; c < wide.columns(); c++) {
+		wideSum += wide(0, c);
+		wideDot += wide(0, c) * wide(0, c) * 2;
+	}
+	assert<long>(wideSum, wide.sum());
+	assert<long>(wideDot, wide.dot(wide + wide));
+	assert<long>(5000, wide.max());
+	assert<bool>(true, std::make_pair(0u, 100000u) == wide.argmax());
+}
+
+void testVectorProducts() {
+	Matrix<long> a(1001, 700);
+	Matrix<long> x(700, 1);
+	Matrix<long> y(1, 1001);
+	initializeCells<long>(a, 3, -7);
+	initializeCells<long>(x, 2, 0);
+	initializeCells<long>(y, 0, -1);
+	//Matrix by vector, with the matrix by rows, by columns and lazy
+	auto gemv = (a * x).copy();
+	auto transposed = (a.transpose().transpose() * x).copy();
+	auto byColumns = (a.transpose().copy().transpose() * x).copy();
+	auto lazy = ((a + a) * x).copy();
+	assert<unsigned>(1001, gemv.rows());
+	assert<unsigned>(1, gemv.columns());
+	for (unsigned r = 0; r < a.rows(); r++) {
+		long expected = 0;
+		for (unsigned k = 0; k < a.columns(); k++) {
+			expected += a(r, k) * x(k, 0);
+		}
+		assert<long>(expected, gemv(r, 0));
+		assert<long>(expected, transposed(r, 0));
+		assert<long>(expected, byColumns(r, 0));
+		assert<long>(2 * expected, lazy(r, 0));
+	}
+	//Covector by matrix, and a chain ending with a vector
+	auto gevm = (y * a).copy();
+	auto gevmByColumns = (y * a.transpose().copy().transpose()).copy();
+	auto chain = (y * a * x).copy();
+	assert<unsigned>(1, gevm.rows());
+	assert<unsigned>(700, gevm.columns());
+	long expectedChain = 0;
+	for (unsigned c = 0; c < a.columns(); c++) {
+		long expected = 0;
+		for (unsigned k = 0; k < a.rows(); k++) {
+			expected += y(0, k) * a(k, c);
+		}
+		assert<long>(expected, gevm(0, c));
+		assert<long>(expected, gevmByColumns(0, c));
+		expectedChain += expected * x(c, 0);
+	}
+	assert<long>(expectedChain, chain(0, 0));
+}
+
+void testConcurrentReaders() {
+	Matrix<long> a(97, 61);
+	Matrix<long> b(61, 83);
+	initializeCells<long>(a, 3, -7);
+	initializeCells<long>(b, 5, 2);
+	auto expected = (a * b).copy();
+	auto product = a * b;
+	//Many threads read the same lazy product: only the first one starts the optimization
+	std::vector<std::thread> readers;
+	std::vector<long> sums(4, 0);
+	for (unsigned t = 0; t < sums.size(); t++) {
+		readers.emplace_back([&product, &sums, t] {
+			for (unsigned r = 0; r < product.rows(); r++) {
+				for (unsigned c = 0; c < product.columns(); c++) {
+					sums[t] += product(r, c);
+				}
+			}
+		});
+	}
+	for (auto &reader : readers) {
+		reader.join();
+	}
+	long sum = 0;
+	for (unsigned r = 0; r < expected.rows(); r++) {
+		for (unsigned c = 0; c < expected.columns(); c++) {
+			sum += expected(r, c);
+		}
+	}
+	for (long s : sums) {
+		assert(sum, s);
+	}
+	assertEquals(expected, product);
+}
+
+void testBlockedMaterialization() {
+	Matrix<int> m(70, 45);
+	initializeCells<int>(m, 100, 1);
+	//Strided source, copied with the blocked transposition
+	auto transposed = m.transpose().copy();
+	//Source without a strided layout, copied with the blocked traversal
+	auto transposedSum = (m + m).transpose().submatrix(3, 5, 40, 61).copy();
+	for (unsigned r = 0; r < m.rows(); r++) {
+		for (unsigned c = 0; c < m.columns(); c++) {
+			assert<int>(m(r, c), transposed(c, r));
+			if (c >= 3 && c < 43 && r >= 5 && r < 66) {
+				assert<int>(2 * m(r, c), transposedSum(c - 3, r - 5));
+			}
+		}
+	}
+}
+
+void testMultiplicationChain() {
+	Matrix<int> a(3, 40);
+	Matrix<int> b(40, 2);
+	Matrix<int> c(2, 30);
+	Matrix<int> d(30, 5);
+	Matrix<int> e(5, 7);
+	initializeCells<int>(a, 1, 2);
+	initializeCells<int>(b, 3, 1);
+	initializeCells<int>(c, 2, 2);
+	initializeCells<int>(d, 1, 3);
+	initializeCells<int>(e, 2, 1);
+	//The optimal order is (a*b)*((c*d)*e), but the result must not depend on it
+	auto chain = a * b * c * d * e;
+	auto leftToRight = ((((a * b).copy() * c).copy() * d).copy() * e).copy();
+	assertEquals(leftToRight, chain);
+	auto withSums = (a + a) * b * c * d * e;
+	for (unsigned r = 0; r < chain.rows(); r++) {
+		for (unsigned col = 0; col < chain.columns(); col++) {
+			assert<int>(2 * chain(r, col), withSums(r, col));
+		}
+	}
+}
+
+void testStridedData() {
+	Matrix<int> m(6, 8);
+	initializeCells<int>(m, 10, 1);
+	assert(true, m.strided().isValid());
+
+	//Views over a matrix expose its memory, composing the layout
+	auto view = m.transpose().submatrix(1, 2, 4, 3);
+	StridedData<int> memory = view.strided();
+	assert(true, memory.isValid());
+	for (unsigned r = 0; r < view.rows(); r++) {
+		for (unsigned c = 0; c < view.columns(); c++) {
+			assert<int>(view(r, c), *memory.at(r, c));
+		}
+	}
+	auto diagonal = m.submatrix(0, 2, 6, 6).diagonal();
+	for (unsigned r = 0; r < diagonal.rows(); r++) {
+		assert<int>(diagonal(r, 0), *diagonal.strided().at(r, 0));
+	}
+
+	//Computed matrices don't have a strided layout
+	assert(false, (m + m).strided().isValid());
+	assertEquals(view, view.copy());
+}
+
 void testBasicStuff() {
 	Matrix<int> sq(10, 10);
 	StaticSizeMatrix<10, 10, int> sqStatic;
@@ -244,6 +922,58 @@ void testBasicStuff() {
 	test<int>(vector);
 }
 
+void testRaggedBlocks() {
+	//The blocks at the edges are smaller than the others
+	std::deque<VectorMatrixData<long>> blocks;
+	blocks.emplace_back(2, 2);
+	blocks.emplace_back(2, 1);
+	blocks.emplace_back(1, 2);
+	blocks.emplace_back(1, 1);
+	for (unsigned b = 0; b < blocks.size(); b++) {
+		for (unsigned r = 0; r < blocks[b].rows(); r++) {
+			for (unsigned c = 0; c < blocks[b].columns(); c++) {
+				blocks[b].set(r, c, 10 * b + 3 * r + c);
+			}
+		}
+	}
+	ConcatenationMD<long, VectorMatrixData<long>> concatenation(blocks, 3, 3);
+	assert<unsigned>(2, concatenation.getNumberOfRowBlocks());
+	assert<unsigned>(2, concatenation.getNumberOfColumnBlocks());
+	assert<long>(4, concatenation.get(1, 1));
+	assert<long>(13, concatenation.get(1, 2));
+	assert<long>(21, concatenation.get(2, 1));
+	assert<long>(30, concatenation.get(2, 2));
+	VectorMatrixData<long> materialized = concatenation.virtualMaterialize(1, 1, 2, 2);
+	assert<long>(13, materialized.get(0, 1));
+	assert<long>(30, materialized.get(1, 1));
+
+	//A product whose sizes are not multiples of the blocks doesn't multiply any padding
+	Tuning::instance().setBlockSizes<long>(Tuning::SQUARE, {64, 48, 40});
+	Matrix<long> a(201, 150);
+	Matrix<long> b(150, 133);
+	initializeCells<long>(a, 3, -2);
+	initializeCells<long>(b, 1, 5);
+	Profiler::start();
+	auto product = (a * b).copy();
+	Profiler::stop();
+	Tuning::instance().clearBlockSizes();
+	std::string text = Profiler::toText();
+	long long flops = 0;
+	for (std::size_t end = text.find(" flops"); end != std::string::npos; end = text.find(" flops", end + 1)) {
+		flops += std::stoll(text.substr(text.rfind(' ', end - 1) + 1));
+	}
+	assert<long long>(2LL * 201 * 150 * 133, flops);
+	for (unsigned r = 0; r < a.rows(); r += 4) {
+		for (unsigned c = 0; c < b.columns(); c++) {
+			long expected = 0;
+			for (unsigned k = 0; k < a.columns(); k++) {
+				expected += a(r, k) * b(k, c);
+			}
+			assert<long>(expected, product(r, c));
+		}
+	}
+}
+
 int main() {
 	/*
 	 * MAIN THAT PERFORMS SOME TESTS
@@ -258,6 +988,69 @@ int main() {
 	std::cout << "Testing multiplication" << std::endl;
 	testMultiplicationAndAddition();
 
+	std::cout << "Testing strided data" << std::endl;
+	testStridedData();
+
+	std::cout << "Testing blocked materialization" << std::endl;
+	testBlockedMaterialization();
+
+	std::cout << "Testing multiplication chain" << std::endl;
+	testMultiplicationChain();
+
+	std::cout << "Testing blocked multiplication" << std::endl;
+	testBlockedMultiplication<int>(300, 257, 131);
+	testBlockedMultiplication<long>(129, 400, 7);
+	testBlockedMultiplication<float>(65, 33, 270);
+	testBlockedMultiplication<double>(200, 190, 180);
+
+	std::cout << "Testing buffer pool" << std::endl;
+	testBufferPool();
+
+	std::cout << "Testing file matrix" << std::endl;
+	testFileMatrix();
+
+	std::cout << "Testing tuning" << std::endl;
+	testTuning();
+
+	std::cout << "Testing profiler" << std::endl;
+	testProfiler();
+
+	std::cout << "Testing fused packing" << std::endl;
+	testFusedPacking();
+
+	std::cout << "Testing static multiplication" << std::endl;
+	testStaticMultiplication();
+
+	std::cout << "Testing static chain" << std::endl;
+	testStaticChain();
+
+	std::cout << "Testing sparse matrices" << std::endl;
+	testSparse<int>(SparseMatrixData<int>::CSR);
+	testSparse<double>(SparseMatrixData<double>::CSC);
+
+	std::cout << "Testing Strassen" << std::endl;
+	testStrassen();
+	std::cout << "Testing concurrent readers" << std::endl;
+	testConcurrentReaders();
+	std::cout << "Testing copy on write" << std::endl;
+	testCopyOnWrite();
+	std::cout << "Testing spans" << std::endl;
+	testSpans();
+	std::cout << "Testing parallel materialization" << std::endl;
+	testParallelMaterialization();
+	std::cout << "Testing assignment" << std::endl;
+	testAssign();
+	std::cout << "Testing elementwise operations" << std::endl;
+	testElementwise();
+	std::cout << "Testing common subexpressions" << std::endl;
+	testCommonSubexpressions();
+	std::cout << "Testing reductions" << std::endl;
+	testReductions();
+	std::cout << "Testing vector products" << std::endl;
+	testVectorProducts();
+	std::cout << "Testing ragged blocks" << std::endl;
+	testRaggedBlocks();
+
 	std::cout << "ALL TESTS PASSED" << std::endl;
 	return 0;
 }